@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "cidr.h"
+
+int cidr_parse(const char *prefix, cidr_range *range) {
+  char host[64];
+  int len = 32;
+
+  snprintf(host, 64, "%s", prefix);
+  char *slash = strchr(host, '/');
+  if (slash != NULL) {
+    *slash = '\0';
+    char *end;
+    len = (int)strtol(slash + 1, &end, 10);
+    if (*end != '\0' || end == slash + 1) return 1;
+  }
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, host, &addr) != 1 || len < 0 || len > 32) return 1;
+
+  uint32_t mask = len == 0 ? 0 : 0xffffffffu << (32 - len);
+  range->first = ntohl(addr.s_addr) & mask;
+  range->last = range->first | ~mask;
+
+  return 0;
+}
+
+int cidr_read_file(const char *path, cidr_range **ranges, size_t *count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("file reading error");
+    return 1;
+  }
+
+  size_t capacity = *count;
+  char buffer[128], prefix[64];
+  int line = 0;
+
+  while (fgets(buffer, 128, file) != NULL) {
+    line++;
+    if (sscanf(buffer, "%63s", prefix) != 1 || prefix[0] == '#') continue;
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 1024;
+      cidr_range *ptr_new = realloc(*ranges, capacity * sizeof(cidr_range));
+      if (ptr_new == NULL) {
+        perror("ranges: memory allocation error");
+        fclose(file);
+        return 1;
+      }
+      *ranges = ptr_new;
+    }
+
+    if (cidr_parse(prefix, &(*ranges)[*count]) != 0) {
+      fprintf(stderr, "%s line %d: wrong prefix %s\n", path, line, prefix);
+      fclose(file);
+      return 1;
+    }
+    (*count)++;
+  }
+
+  fclose(file);
+
+  return 0;
+}
+
+static int compare_ranges(const void *a, const void *b) {
+  uint32_t x = ((const cidr_range*)a)->first, y = ((const cidr_range*)b)->first;
+
+  return x < y ? -1 : x > y;
+}
+
+size_t cidr_normalize(cidr_range *ranges, size_t count) {
+  if (count == 0) return 0;
+
+  qsort(ranges, count, sizeof(cidr_range), compare_ranges);
+
+  size_t last = 0;
+  for (size_t i = 1; i < count; i++) {
+    // 64 bits, so that a range ending at 255.255.255.255 can't wrap around.
+    if ((uint64_t)ranges[i].first <= (uint64_t)ranges[last].last + 1) {
+      if (ranges[i].last > ranges[last].last) ranges[last].last = ranges[i].last;
+    } else {
+      ranges[++last] = ranges[i];
+    }
+  }
+
+  return last + 1;
+}
+
+size_t cidr_subtract(const cidr_range *include, size_t include_count,
+                     const cidr_range *exclude, size_t exclude_count, cidr_range *out) {
+  size_t count = 0, j = 0;
+
+  // Both lists are sorted, so every exclude range is passed over only once.
+  for (size_t i = 0; i < include_count; i++) {
+    uint64_t first = include[i].first, last = include[i].last;
+
+    while (j < exclude_count && exclude[j].last < first) j++;
+
+    for (size_t k = j; k < exclude_count && exclude[k].first <= last && first <= last; k++) {
+      if (exclude[k].first > first)
+        out[count++] = (cidr_range){(uint32_t)first, exclude[k].first - 1};
+      if ((uint64_t)exclude[k].last + 1 > first) first = (uint64_t)exclude[k].last + 1;
+    }
+
+    if (first <= last) out[count++] = (cidr_range){(uint32_t)first, (uint32_t)last};
+  }
+
+  return count;
+}
+
+char *cidr_format(const cidr_range *ranges, size_t count) {
+  char *list = NULL;
+  size_t size = 0;
+
+  FILE *fp = open_memstream(&list, &size);
+  if (fp == NULL) {
+    perror("list: memory allocation error");
+    return NULL;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    uint64_t first = ranges[i].first, last = ranges[i].last;
+
+    while (first <= last) {
+      // The largest block that starts at first and does not go past last.
+      uint64_t block = first == 0 ? (uint64_t)1 << 32 : first & -first;
+      while (block > last - first + 1) block >>= 1;
+
+      int len = 32;
+      for (uint64_t b = block; b > 1; b >>= 1) len--;
+
+      uint32_t addr = (uint32_t)first;
+      fprintf(fp, "%s%u.%u.%u.%u/%d", ftell(fp) > 0 ? ", " : "",
+        addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, len);
+
+      first += block;
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    free(list);
+    return NULL;
+  }
+
+  return list;
+}
@@ -0,0 +1,61 @@
+#ifndef CIDR_H
+#define CIDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  uint32_t first;
+  uint32_t last;
+} cidr_range;
+
+/**
+ * One IPv4 prefix per line (a.b.c.d/len or a bare address), lines
+ * starting with '#' are skipped. The ranges are appended to the array.
+ *
+ * @param char prefix list file.
+ * @param struct cidr_range pointer to the array, realloc()'ed as needed.
+ * @param size_t pointer to the number of ranges in the array.
+ * @return 0 if successful and 1 on error.
+ */
+int cidr_read_file(const char *path, cidr_range **ranges, size_t *count);
+
+/**
+ * @param char prefix such as 10.0.0.0/28.
+ * @param struct cidr_range pointer to which the range will be written.
+ * @return 0 if successful and 1 on error.
+ */
+int cidr_parse(const char *prefix, cidr_range *range);
+
+/**
+ * Sorts the ranges and merges the overlapping and adjacent ones, in place.
+ *
+ * @param struct cidr_range array of ranges.
+ * @param size_t number of ranges.
+ * @return number of ranges left.
+ */
+size_t cidr_normalize(cidr_range *ranges, size_t count);
+
+/**
+ * Both inputs must be normalized, the output is normalized too.
+ *
+ * @param struct cidr_range ranges to keep.
+ * @param size_t number of ranges to keep.
+ * @param struct cidr_range ranges to remove.
+ * @param size_t number of ranges to remove.
+ * @param struct cidr_range output array with room for include_count + exclude_count ranges.
+ * @return number of ranges in the output.
+ */
+size_t cidr_subtract(const cidr_range *include, size_t include_count,
+                     const cidr_range *exclude, size_t exclude_count, cidr_range *out);
+
+/**
+ * Splits normalized ranges into the smallest possible set of prefixes.
+ *
+ * @param struct cidr_range normalized ranges.
+ * @param size_t number of ranges.
+ * @return "a.b.c.d/len, ..." to free() or NULL on error.
+ */
+char *cidr_format(const cidr_range *ranges, size_t count);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <ctype.h>
 #include <getopt.h>
 #include <string.h>
 #include <stdlib.h>
@@ -6,6 +7,15 @@
 
 #include "request.h"
 #include "wireguard.h"
+#include "journal.h"
+#include "topology.h"
+#include "watch.h"
+#include "tc.h"
+#include "cidr.h"
+#include "dns.h"
+#include "profile.h"
+#include "export.h"
+#include "mask.h"
 
 /**
  * @param char folder path.
@@ -22,6 +32,215 @@ static int dir_exists(const char *path) {
   return 0;
 }
 
+/**
+ * Client names are read one per line, empty lines are skipped. A name
+ * becomes a file name in /tmp or in the archive, so it can't hold a '/'.
+ *
+ * @param char file with client names.
+ * @param size_t pointer to which the number of names will be written.
+ * @return array of names or NULL on error.
+ */
+static char **read_names(const char *path, size_t *count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("file reading error");
+    return NULL;
+  }
+
+  char **names = NULL, buffer[128];
+  size_t capacity = 0;
+  int line = 0;
+  *count = 0;
+
+  while (fgets(buffer, 128, file) != NULL) {
+    line++;
+    // The rest of an over-long line must not become a name of its own.
+    if (strchr(buffer, '\n') == NULL && !feof(file)) {
+      int c;
+      while ((c = fgetc(file)) != EOF && c != '\n');
+      fprintf(stderr, "line %d: client name is too long\n", line);
+      continue;
+    }
+
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    if (buffer[0] == '\0') continue;
+    if (strlen(buffer) >= 64) {
+      fprintf(stderr, "line %d: client name is too long\n", line);
+      continue;
+    }
+    if (strpbrk(buffer, "/\t") != NULL || strcmp(buffer, ".") == 0 || strcmp(buffer, "..") == 0) {
+      fprintf(stderr, "line %d: invalid client name %s\n", line, buffer);
+      continue;
+    }
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      char **ptr_new = realloc(names, capacity * sizeof(char*));
+      if (ptr_new == NULL) {
+        perror("names: memory allocation error");
+        break;
+      }
+      names = ptr_new;
+    }
+
+    names[*count] = strdup(buffer);
+    if (names[*count] == NULL) {
+      perror("name: memory allocation error");
+      break;
+    }
+    (*count)++;
+  }
+
+  fclose(file);
+
+  return names;
+}
+
+/**
+ * Include prefixes minus exclude prefixes, plus the tunnel subnet of
+ * the server so the client can still reach it.
+ *
+ * @param char server name.
+ * @param char include prefix list file.
+ * @param char exclude prefix list file or NULL.
+ * @return AllowedIPs list to free() or NULL on error.
+ */
+static char *split_tunnel(const char *server, const char *include, const char *exclude) {
+  cidr_range *in = NULL, *ex = NULL;
+  size_t in_count = 0, ex_count = 0;
+
+  if (cidr_read_file(include, &in, &in_count) != 0 ||
+      (exclude != NULL && cidr_read_file(exclude, &ex, &ex_count) != 0)) {
+    free(in);
+    free(ex);
+    return NULL;
+  }
+
+  in_count = cidr_normalize(in, in_count);
+  ex_count = cidr_normalize(ex, ex_count);
+
+  char *list = NULL;
+  cidr_range *out = malloc((in_count + ex_count + 1) * sizeof(cidr_range));
+
+  if (out != NULL) {
+    size_t count = cidr_subtract(in, in_count, ex, ex_count, out);
+
+    int server_number = 0;
+    for (const char *s = server; *s != '\0'; s++)
+      if (isdigit((unsigned char)*s))
+        server_number = server_number * 10 + (*s - '0');
+
+    char tunnel[32];
+    snprintf(tunnel, 32, "10.0.%d.0/%d", server_number, MASK_SERVER);
+    if (cidr_parse(tunnel, &out[count]) == 0) count++;
+
+    list = cidr_format(out, cidr_normalize(out, count));
+  } else {
+    perror("ranges: memory allocation error");
+  }
+
+  if (list != NULL) {
+    printf("split tunnel: ");
+    printf("\033[32m%zu\033[0m", in_count);
+    printf(" included, ");
+    printf("\033[31m%zu\033[0m", ex_count);
+    printf(" excluded ranges\n");
+  }
+
+  free(in);
+  free(ex);
+  free(out);
+
+  return list;
+}
+
+/**
+ * Every client goes through the journal, so an interrupted run is finished
+ * by journal_recover() before the next one.
+ *
+ * @param struct wireguard_settings with all user information.
+ * @param char array of client names.
+ * @param size_t number of client names.
+ * @param char yes/no to the question about adding dns.
+ * @param char bandwidth tier or NULL.
+ * @param char include prefix list file for a split tunnel or NULL.
+ * @param char exclude prefix list file or NULL.
+ * @param char tar archive for the client configs, "-" for stdout, or NULL for /tmp.
+ * @param int 1 to add QR codes to the archive.
+ * @param int operations per journal sync.
+ */
+static void add_clients(wireguard_settings *wgs, char **names, size_t count,
+                        const char *issue, const char *tier,
+                        const char *include, const char *exclude,
+                        const char *target, int qr, int group) {
+  char *server = NULL, *publicip = NULL;
+  export_archive archive;
+  int exported = 0;
+
+  // Opened before anything is printed, with "-" all messages have to go to stderr.
+  if (target != NULL && export_open(&archive, target, qr) != 0) return;
+
+  if (journal_recover() != 0)
+    fprintf(stderr, "journal: unfinished operations remain, they will be retried\n");
+
+  publicip = curl_get_request("https://ifconfig.me/ip");
+  if (publicip != NULL) {
+    if (wg_client_count_on_servers(&server) == 0) {
+      #ifdef BASHENABLE
+        wg_stop_server(server);
+      #endif
+      journal jn;
+      if (wg_generate_pub_key(wgs, server) == 0 && journal_open(&jn) == 0) {
+        // The journal closes the archive, only then may it forget the intents.
+        if (target != NULL) {
+          jn.archive = &archive;
+          exported = 1;
+        }
+        jn.group_size = group;
+        // The list is the same for every client of the run, it is aggregated once.
+        char id[24], *list = NULL, *allowed = NULL;
+        if (include != NULL) {
+          list = split_tunnel(server, include, exclude);
+          if (list != NULL && journal_save_list(list, id) == 0) allowed = id;
+        }
+
+        // Intents that can't get an address are never queued.
+        size_t room = 0;
+        wg_address_pool *pool = malloc(sizeof(wg_address_pool));
+        if (pool == NULL) perror("pool: memory allocation error");
+        else if (wg_pool_load(server, pool) == 0) room = wg_pool_free(pool);
+        free(pool);
+
+        if (include == NULL || allowed != NULL) {
+          for (size_t i = 0; i < count; i++) {
+            if (i == room) {
+              fprintf(stderr, "%s is full: only %zu of %zu clients fit\n", server, room, count);
+              break;
+            }
+            strcpy(wgs->name, names[i]);
+            // A client without its own keys would get the keys of the previous one.
+            if (wg_generate_keys(wgs) != 0 ||
+                journal_add_client(&jn, wgs, server, publicip, issue, tier, allowed) != 0) {
+              fprintf(stderr, "batch stopped at %s, the clients before it are kept\n", names[i]);
+              break;
+            }
+          }
+        }
+        free(list);
+        journal_close(&jn);
+      }
+      // wg-quick up runs ww --shape from the PostUp of the server, the new tiers included.
+      #ifdef BASHENABLE
+        wg_start_server(server);
+      #endif
+    }
+  }
+  free(publicip);
+  free(server);
+
+  if (target != NULL && !exported) export_close(&archive);
+}
+
 int main(int argc, char *argv[]) {
   #ifdef TEMPDIR
     int dir = dir_exists(TMP_WG_PATH);
@@ -33,6 +252,19 @@ int main(int argc, char *argv[]) {
   static struct option long_options[] = {
     {"help", no_argument, 0, 'h'},
     {"add", required_argument, 0, 'a'},
+    {"batch", required_argument, 0, 'b'},
+    {"topology", required_argument, 0, 't'},
+    {"watch", required_argument, 0, 'w'},
+    {"tier", required_argument, 0, 'r'},
+    {"shape", required_argument, 0, 's'},
+    {"include", required_argument, 0, 'i'},
+    {"exclude", required_argument, 0, 'e'},
+    {"dns", required_argument, 0, 'd'},
+    {"profile", required_argument, 0, 'p'},
+    {"measure", required_argument, 0, 'm'},
+    {"export", required_argument, 0, 'x'},
+    {"qr", no_argument, 0, 'q'},
+    {"group", required_argument, 0, 'g'},
     {0, 0, 0, 0},
   };
 
@@ -43,10 +275,12 @@ int main(int argc, char *argv[]) {
   }
   wg_settings_init(wgs);
 
-  char *server = NULL, *publicip = NULL;
+  char **names = NULL, *tier = NULL, *include = NULL, *exclude = NULL, *target = NULL;
+  size_t count = 0;
+  int qr = 0, group = JOURNAL_GROUP;
 
   int index = 0;
-  while ((index = getopt_long(argc, argv, "ha:", long_options, NULL)) != -1) {
+  while ((index = getopt_long(argc, argv, "ha:b:t:w:r:s:i:e:d:p:m:x:qg:", long_options, NULL)) != -1) {
     switch (index) {
       case 'h':
         printf(
@@ -55,17 +289,68 @@ int main(int argc, char *argv[]) {
           "\nAvailable options:\n"
           "-h, --help                              Display information about all flags\n"
           "--------------------------------------------\n"
-          "-a, --add    [server|client] [yes|no]   Create a wireguard server/client configuration\n"
+          "-a, --add    [server|client] [yes|no|local] Create a wireguard server/client configuration\n"
           "                                        After the name, specify whether to add DNS\n"
-          "       * ww --add server null\n"
-          "       * ww --add client [yes|no]\n");
+          "                                        local uses the --dns forwarder of the server\n"
+          "                                        For a server local starts that forwarder in PostUp\n"
+          "       * ww --add server [null|local]\n"
+          "       * ww --add client [yes|no|local]\n"
+          "--------------------------------------------\n"
+          "-b, --batch  [file] [yes|no]            Create a client for every name in the file\n"
+          "                                        One name per line, DNS as for --add\n"
+          "       * ww --batch clients.txt [yes|no]\n"
+          "--------------------------------------------\n"
+          "-t, --topology [mesh|hub] [file] [dir]  Create configs for every node of an inventory\n"
+          "                                        Line format: name address/prefix host:port|- [key]\n"
+          "                                        For hub the first node is the hub\n"
+          "       * ww --topology mesh nodes.txt ./mesh\n"
+          "--------------------------------------------\n"
+          "-w, --watch  [yes|no]                   Follow config changes made by other tools\n"
+          "                                        yes also applies peer changes to running servers\n"
+          "       * ww --watch [yes|no]\n"
+          "--------------------------------------------\n"
+          "-r, --tier   [bronze|silver|gold]       Rate limit for clients created by --add/--batch\n"
+          "                                        Must come before --add/--batch\n"
+          "       * ww --tier silver --add client [yes|no]\n"
+          "-s, --shape  [server]                   Install the tc classes of all tiered clients\n"
+          "                                        Also done by the PostUp of the server\n"
+          "       * ww --shape wg0\n"
+          "--------------------------------------------\n"
+          "-i, --include [file]                    Split tunnel: only these prefixes go through the server\n"
+          "-e, --exclude [file]                    Prefixes removed from the --include list\n"
+          "                                        One prefix per line, must come before --add/--batch\n"
+          "       * ww --include corp.txt --exclude lan.txt --add client [yes|no]\n"
+          "--------------------------------------------\n"
+          "-d, --dns    [server] [upstreams]       Run a caching DNS forwarder on the server tunnel address\n"
+          "                                        Upstreams: ip[:port],... (default " DNS_UPSTREAMS ")\n"
+          "                                        Servers added with local start it in PostUp as ww-dns-<server>\n"
+          "       * ww --dns wg0\n"
+          "       * ww --dns wg0 1.1.1.1,8.8.8.8\n"
+          "--------------------------------------------\n"
+          "-p, --profile [mobile|desktop|static]  PersistentKeepalive 15/40/off for clients created\n"
+          "                                        by --add/--batch, must come before them (default 20)\n"
+          "       * ww --profile static --add client [yes|no]\n"
+          "-m, --measure [server] [seconds]        Sample the peers of a running server and\n"
+          "                                        recommend a profile for each of them\n"
+          "       * ww --measure wg0 600\n"
+          "--------------------------------------------\n"
+          "-x, --export [file|-]                   Write the client configs of --add/--batch into\n"
+          "                                        a tar archive instead of /tmp, .gz is compressed\n"
+          "-q, --qr                                Also put a QR code PNG of every config in it\n"
+          "                                        Both must come before --add/--batch\n"
+          "       * ww --export clients.tar.gz --qr --batch clients.txt [yes|no]\n"
+          "       * ww --export - --batch clients.txt no | ssh host tar -x\n"
+          "--------------------------------------------\n"
+          "-g, --group  [1-256]                    Clients per journal sync for --add/--batch\n"
+          "                                        Must come before them (default 32)\n"
+          "       * ww --group 128 --batch clients.txt [yes|no]\n");
         break;
       case 'a':
         if (optind + 1 == argc) {
-          if (strcmp(argv[2], "server") == 0) {
-            if (wg_init_settings_server(wgs->name, wgs->subnetwork, wgs->port) == 0) {
-              wg_generate_keys(wgs);
-              wg_create_config_server(wgs);
+          if (strcmp(optarg, "server") == 0) {
+            if (wg_init_settings_server(wgs->name, wgs->subnetwork, wgs->port) == 0 &&
+                wg_generate_keys(wgs) == 0) {
+              wg_create_config_server(wgs, strcmp(argv[optind], "local") == 0);
               printf("\033[31mALERT\033[0m");
               printf(": if you are using a firewall, be sure to open port ");
               printf("\033[32m%s\033[0m", wgs->port);
@@ -74,28 +359,101 @@ int main(int argc, char *argv[]) {
                 wg_start_systemctl(wgs->name);
               #endif
             }
-          } else if (strcmp(argv[2], "client") == 0) {
+          } else if (strcmp(optarg, "client") == 0) {
             if (strlen(optarg) >= 64) break;
-            strcpy(wgs->name, optarg);
-            publicip = curl_get_request("https://ifconfig.me/ip");
-            if (publicip != NULL) {
-              if (wg_client_count_on_servers(&server) == 0) {
-                #ifdef BASHENABLE
-                  wg_stop_server(server);
-                #endif
-                wg_generate_keys(wgs);
-                wg_generate_pub_key(wgs, server);
-                if (wg_init_settings_client(server, wgs->subnetwork, wgs->port) == 0) {
-                  wg_add_client_in_config(wgs, server);
-                  wg_create_config_client(wgs, publicip, argv[3]);
-                }
-                #ifdef BASHENABLE
-                  wg_start_server(server);
-                #endif
-              }
-            }
-            free(publicip);
-            free(server);
+            add_clients(wgs, &optarg, 1, argv[optind], tier, include, exclude, target, qr, group);
+          }
+        }
+        break;
+      case 'b':
+        if (optind + 1 == argc) {
+          names = read_names(optarg, &count);
+          if (names != NULL) {
+            add_clients(wgs, names, count, argv[optind], tier, include, exclude, target, qr, group);
+            for (size_t i = 0; i < count; i++) free(names[i]);
+            free(names);
+          }
+        }
+        break;
+      case 't':
+        if (optind + 2 == argc) {
+          topology_kind kind;
+          if (strcmp(optarg, "mesh") == 0) kind = TOPOLOGY_MESH;
+          else if (strcmp(optarg, "hub") == 0) kind = TOPOLOGY_HUB;
+          else break;
+
+          topology_node *nodes = topology_read_inventory(argv[optind], kind, &count);
+          if (nodes != NULL && count > 1 && topology_generate_keys(nodes, count) == 0)
+            topology_create_configs(nodes, count, kind, argv[optind+1]);
+          free(nodes);
+        }
+        break;
+      case 'r':
+        if (tc_find_tier(optarg) == NULL) {
+          printf("unknown tier: use --help for details\n");
+          wg_settings_free_memory(wgs);
+          exit(1);
+        }
+        tier = optarg;
+        break;
+      case 'p':
+        if (profile_find(optarg) == NULL) {
+          printf("unknown profile: use --help for details\n");
+          wg_settings_free_memory(wgs);
+          exit(1);
+        }
+        wgs->keepalive = profile_find(optarg)->keepalive;
+        break;
+      case 'm':
+        if (optind == argc || optind + 1 == argc) {
+          int seconds = optind < argc ? atoi(argv[optind]) : PROFILE_WINDOW_S;
+          if (seconds <= 0 || profile_measure(optarg, seconds) != 0) {
+            wg_settings_free_memory(wgs);
+            exit(1);
+          }
+          optind = argc;
+        }
+        break;
+      case 'x':
+        target = optarg;
+        break;
+      case 'q':
+        qr = 1;
+        break;
+      case 'g':
+        group = atoi(optarg);
+        if (group < 1 || group > JOURNAL_GROUP_MAX) {
+          printf("wrong group size: use --help for details\n");
+          wg_settings_free_memory(wgs);
+          exit(1);
+        }
+        break;
+      case 'i':
+        include = optarg;
+        break;
+      case 'e':
+        exclude = optarg;
+        break;
+      case 's':
+        if (optind == argc && tc_apply(optarg) != 0) {
+          wg_settings_free_memory(wgs);
+          exit(1);
+        }
+        break;
+      case 'd':
+        if (optind == argc || optind + 1 == argc) {
+          if (dns_forwarder(optarg, optind < argc ? argv[optind] : NULL) != 0) {
+            wg_settings_free_memory(wgs);
+            exit(1);
+          }
+          optind = argc;
+        }
+        break;
+      case 'w':
+        if (optind == argc) {
+          if (watch_config_dir(strcmp(optarg, "yes") == 0) != 0) {
+            wg_settings_free_memory(wgs);
+            exit(1);
           }
         }
         break;
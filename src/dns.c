@@ -0,0 +1,824 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <poll.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "dns.h"
+
+#define DNS_MAX_UPSTREAMS 8
+#define DNS_PACKET 4096
+// Every query upstream has its own socket, this bounds the open descriptors.
+#define DNS_MAX_PENDING 512
+// Bytes at the end of a cache key that hold the EDNS payload size and DO bit.
+#define EDNS_KEY 3
+
+typedef struct cache_entry {
+  struct cache_entry *next;
+  unsigned char *key;
+  size_t key_len;
+  unsigned char *msg;
+  size_t msg_len;
+  long stored;
+  long expires;
+} cache_entry;
+
+typedef struct {
+  struct sockaddr_in addr;
+  uint16_t id;
+} waiter;
+
+typedef struct pending {
+  struct pending *next;
+  int fd;
+  uint16_t upstream_id;
+  unsigned char *key;
+  size_t key_len;
+  unsigned char *query;
+  size_t query_len;
+  waiter *waiters;
+  size_t count;
+  size_t capacity;
+  int upstream;
+  long started;
+  long deadline;
+} pending;
+
+typedef struct {
+  int listen_fd;
+  int tcp_fd;
+  struct sockaddr_in upstreams[DNS_MAX_UPSTREAMS];
+  int upstreams_count;
+  cache_entry *cache[DNS_CACHE_SIZE];
+  size_t cached;
+  pending *pending;
+  size_t pending_count;
+  unsigned long queries, hits, coalesced, forwarded, failed, tcp;
+  long upstream_ms;
+  int relays;
+} dns_state;
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+// Only interrupts ppoll(), the relays are reaped in the loop.
+static void on_child(int sig) {
+  (void)sig;
+}
+
+/**
+ * @return monotonic time in milliseconds.
+ */
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @param char ip[:port].
+ * @param int port to use when none is given.
+ * @param struct sockaddr_in pointer to which the address will be written.
+ * @return 0 if successful and 1 on error.
+ */
+static int parse_address(const char *text, int port, struct sockaddr_in *addr) {
+  char host[64];
+
+  snprintf(host, 64, "%s", text);
+  char *colon = strchr(host, ':');
+  if (colon != NULL) {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(port);
+
+  return inet_pton(AF_INET, host, &addr->sin_addr) == 1 && port > 0 && port < 65536 ? 0 : 1;
+}
+
+/**
+ * @param char message.
+ * @param size_t message size.
+ * @param size_t pointer to the offset of the name, moved past it.
+ * @return 0 if successful and 1 for a malformed name.
+ */
+static int skip_name(const unsigned char *msg, size_t len, size_t *off) {
+  while (*off < len) {
+    unsigned char label = msg[*off];
+    if (label == 0) {
+      (*off)++;
+      return 0;
+    }
+    if ((label & 0xc0) == 0xc0) {
+      *off += 2;
+      return *off <= len ? 0 : 1;
+    }
+    *off += label + 1;
+  }
+
+  return 1;
+}
+
+/**
+ * The cache key is the question with its labels lowercased, so that
+ * Example.com and example.com share an entry, followed by what the client
+ * said in EDNS: an answer fetched for a client that takes 1232 bytes or
+ * DNSSEC records must not go to one that only takes 512 bytes.
+ *
+ * @param char message.
+ * @param size_t message size.
+ * @param char pointer to which the key will be written (DNS_PACKET bytes).
+ * @param size_t pointer to which the key size will be written, the last EDNS_KEY bytes are EDNS.
+ * @return 0 if successful and 1 for a message without a valid question.
+ */
+static int question_key(const unsigned char *msg, size_t len, unsigned char *key, size_t *key_len) {
+  if (len < 12 || ((msg[4] << 8) | msg[5]) != 1) return 1;
+
+  size_t off = 12;
+  while (off < len && msg[off] != 0) {
+    size_t label = msg[off];
+    if ((label & 0xc0) != 0 || off + label + 1 > len) return 1;
+    key[off - 12] = label;
+    for (size_t i = 1; i <= label; i++) key[off - 12 + i] = tolower(msg[off + i]);
+    off += label + 1;
+  }
+  // The root label, QTYPE and QCLASS are taken as they are.
+  if (off + 5 > len) return 1;
+  memcpy(key + off - 12, msg + off, 5);
+  off += 5;
+  *key_len = off - 12;
+
+  // Payload size and DO bit of the OPT record, zero without one.
+  unsigned char edns[EDNS_KEY] = {0, 0, 0};
+  int records = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+  for (int i = 0; i < records; i++) {
+    if (skip_name(msg, len, &off) != 0 || off + 10 > len) return 1;
+    if (((msg[off] << 8) | msg[off+1]) == 41) {
+      edns[0] = msg[off+2];
+      edns[1] = msg[off+3];
+      edns[2] = msg[off+6] & 0x80;
+    }
+    off += 10 + ((msg[off+8] << 8) | msg[off+9]);
+    if (off > len) return 1;
+  }
+
+  memcpy(key + *key_len, edns, EDNS_KEY);
+  *key_len += EDNS_KEY;
+
+  return 0;
+}
+
+/**
+ * Walks all records, finds the smallest TTL and optionally ages them.
+ *
+ * @param char message.
+ * @param size_t message size.
+ * @param uint32_t pointer to which the smallest TTL will be written, UINT32_MAX without records.
+ * @param uint32_t seconds to subtract from every TTL, 0 to leave them as they are.
+ * @return 0 if successful and 1 for a malformed message.
+ */
+static int walk_ttls(unsigned char *msg, size_t len, uint32_t *min_ttl, uint32_t age) {
+  size_t off = 12;
+  int questions = (msg[4] << 8) | msg[5];
+  int records = ((msg[6] << 8) | msg[7]) + ((msg[8] << 8) | msg[9]) + ((msg[10] << 8) | msg[11]);
+
+  *min_ttl = UINT32_MAX;
+
+  for (int i = 0; i < questions; i++) {
+    if (skip_name(msg, len, &off) != 0) return 1;
+    off += 4;
+  }
+
+  for (int i = 0; i < records; i++) {
+    if (skip_name(msg, len, &off) != 0 || off + 10 > len) return 1;
+
+    uint16_t type = (msg[off] << 8) | msg[off+1];
+    uint16_t rdlen = (msg[off+8] << 8) | msg[off+9];
+
+    // OPT carries EDNS flags in place of a TTL.
+    if (type != 41) {
+      uint32_t ttl = ((uint32_t)msg[off+4] << 24) | (msg[off+5] << 16) | (msg[off+6] << 8) | msg[off+7];
+      if (age > 0) {
+        ttl = ttl > age ? ttl - age : 0;
+        msg[off+4] = ttl >> 24;
+        msg[off+5] = ttl >> 16;
+        msg[off+6] = ttl >> 8;
+        msg[off+7] = ttl;
+      }
+      if (ttl < *min_ttl) *min_ttl = ttl;
+    }
+
+    off += 10 + rdlen;
+    if (off > len) return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @param char key.
+ * @param size_t key size.
+ * @return bucket of the key.
+ */
+static size_t bucket_of(const unsigned char *key, size_t key_len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < key_len; i++) {
+    hash ^= key[i];
+    hash *= 16777619u;
+  }
+
+  return hash % DNS_CACHE_SIZE;
+}
+
+static void free_entry(cache_entry *entry) {
+  free(entry->key);
+  free(entry->msg);
+  free(entry);
+}
+
+/**
+ * @param struct dns_state forwarder state.
+ * @param char key.
+ * @param size_t key size.
+ * @param long current time.
+ * @return fresh entry or NULL, expired entries of the bucket are dropped on the way.
+ */
+static cache_entry *cache_lookup(dns_state *dns, const unsigned char *key, size_t key_len, long now) {
+  cache_entry **link = &dns->cache[bucket_of(key, key_len)];
+
+  while (*link != NULL) {
+    cache_entry *entry = *link;
+    if (entry->expires <= now) {
+      *link = entry->next;
+      free_entry(entry);
+      dns->cached--;
+      continue;
+    }
+    if (entry->key_len == key_len && memcmp(entry->key, key, key_len) == 0) return entry;
+    link = &entry->next;
+  }
+
+  return NULL;
+}
+
+/**
+ * Answers with NOERROR/NXDOMAIN and at least one record are cached for their smallest TTL.
+ *
+ * @param struct dns_state forwarder state.
+ * @param char key.
+ * @param size_t key size.
+ * @param char upstream answer.
+ * @param size_t answer size.
+ * @param long current time.
+ */
+static void cache_store(dns_state *dns, const unsigned char *key, size_t key_len,
+                        unsigned char *msg, size_t len, long now) {
+  int rcode = msg[3] & 0x0f, truncated = msg[2] & 0x02;
+  uint32_t ttl;
+
+  if ((rcode != 0 && rcode != 3) || truncated) return;
+  if (walk_ttls(msg, len, &ttl, 0) != 0 || ttl == 0 || ttl == UINT32_MAX) return;
+  if (ttl > DNS_MAX_TTL) ttl = DNS_MAX_TTL;
+
+  // The existing entry, if any, is replaced. Expired ones go away in the lookup.
+  size_t bucket = bucket_of(key, key_len);
+  cache_entry *old = cache_lookup(dns, key, key_len, now);
+  if (old != NULL) {
+    old->expires = now;
+    cache_lookup(dns, key, key_len, now);
+  }
+
+  // Full cache: the newest entry of the bucket makes room.
+  if (dns->cached >= DNS_CACHE_SIZE) {
+    cache_entry *victim = dns->cache[bucket];
+    if (victim == NULL) return;
+    dns->cache[bucket] = victim->next;
+    free_entry(victim);
+    dns->cached--;
+  }
+
+  cache_entry *entry = malloc(sizeof(cache_entry));
+  if (entry == NULL) return;
+  entry->key = malloc(key_len);
+  entry->msg = malloc(len);
+  if (entry->key == NULL || entry->msg == NULL) {
+    free_entry(entry);
+    return;
+  }
+
+  memcpy(entry->key, key, key_len);
+  memcpy(entry->msg, msg, len);
+  entry->key_len = key_len;
+  entry->msg_len = len;
+  entry->stored = now;
+  entry->expires = now + (long)ttl * 1000;
+  entry->next = dns->cache[bucket];
+  dns->cache[bucket] = entry;
+  dns->cached++;
+}
+
+/**
+ * @param struct dns_state forwarder state.
+ * @param char answer, its ID is overwritten.
+ * @param size_t answer size.
+ * @param struct waiter client that asked.
+ */
+static void reply(dns_state *dns, unsigned char *msg, size_t len, const waiter *w) {
+  msg[0] = w->id >> 8;
+  msg[1] = w->id;
+
+  sendto(dns->listen_fd, msg, len, 0, (const struct sockaddr*)&w->addr, sizeof(w->addr));
+}
+
+/**
+ * A forged answer has to guess the ID and the source port of one query,
+ * both are random: the ID comes from getrandom() and every query, and
+ * every retry, goes out through a new socket with its own ephemeral port.
+ *
+ * @param struct dns_state forwarder state.
+ * @param struct pending query to (re)send to its current upstream.
+ * @param long current time.
+ * @return 0 if successful and 1 on error.
+ */
+static int send_upstream(dns_state *dns, pending *p, long now) {
+  uint16_t id;
+
+  if (p->fd != -1) close(p->fd);
+  p->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (p->fd == -1 || getrandom(&id, sizeof(id), 0) != sizeof(id)) {
+    perror("dns: upstream socket error");
+    return 1;
+  }
+
+  p->upstream_id = id;
+  p->query[0] = id >> 8;
+  p->query[1] = id;
+  p->deadline = now + DNS_TIMEOUT_MS;
+
+  sendto(p->fd, p->query, p->query_len, 0,
+         (const struct sockaddr*)&dns->upstreams[p->upstream], sizeof(struct sockaddr_in));
+
+  return 0;
+}
+
+static void free_pending(dns_state *dns, pending *p) {
+  for (pending **link = &dns->pending; *link != NULL; link = &(*link)->next) {
+    if (*link == p) {
+      *link = p->next;
+      dns->pending_count--;
+      break;
+    }
+  }
+
+  if (p->fd != -1) close(p->fd);
+  free(p->key);
+  free(p->query);
+  free(p->waiters);
+  free(p);
+}
+
+/**
+ * @param struct pending query waiting for an answer.
+ * @param struct sockaddr_in client address.
+ * @param uint16_t ID of the client query.
+ * @return 0 if successful and 1 on error.
+ */
+static int add_waiter(pending *p, const struct sockaddr_in *addr, uint16_t id) {
+  if (p->count == p->capacity) {
+    size_t capacity = p->capacity ? p->capacity * 2 : 4;
+    waiter *ptr_new = realloc(p->waiters, capacity * sizeof(waiter));
+    if (ptr_new == NULL) return 1;
+    p->waiters = ptr_new;
+    p->capacity = capacity;
+  }
+
+  p->waiters[p->count].addr = *addr;
+  p->waiters[p->count].id = id;
+  p->count++;
+
+  return 0;
+}
+
+static void handle_client(dns_state *dns, unsigned char *msg, size_t len,
+                          const struct sockaddr_in *from) {
+  unsigned char key[DNS_PACKET];
+  size_t key_len;
+
+  // Only standard queries with a single question.
+  if (len < 12 || (msg[2] & 0x80) || (msg[2] & 0x78) || question_key(msg, len, key, &key_len) != 0)
+    return;
+
+  long now = now_ms();
+  uint16_t id = (msg[0] << 8) | msg[1];
+  dns->queries++;
+
+  cache_entry *entry = cache_lookup(dns, key, key_len, now);
+  if (entry != NULL) {
+    unsigned char answer[DNS_PACKET];
+    uint32_t ttl;
+    waiter w = {*from, id};
+
+    memcpy(answer, entry->msg, entry->msg_len);
+    walk_ttls(answer, entry->msg_len, &ttl, (now - entry->stored) / 1000);
+    reply(dns, answer, entry->msg_len, &w);
+    dns->hits++;
+    return;
+  }
+
+  for (pending *p = dns->pending; p != NULL; p = p->next) {
+    if (p->key_len == key_len && memcmp(p->key, key, key_len) == 0) {
+      if (add_waiter(p, from, id) == 0) dns->coalesced++;
+      return;
+    }
+  }
+
+  // Too many questions in flight, the client retries later.
+  if (dns->pending_count >= DNS_MAX_PENDING) return;
+
+  pending *p = calloc(1, sizeof(pending));
+  if (p == NULL) return;
+  p->fd = -1;
+  p->key = malloc(key_len);
+  p->query = malloc(len);
+  if (p->key == NULL || p->query == NULL || add_waiter(p, from, id) != 0) {
+    free(p->key);
+    free(p->query);
+    free(p->waiters);
+    free(p);
+    return;
+  }
+
+  memcpy(p->key, key, key_len);
+  memcpy(p->query, msg, len);
+  p->key_len = key_len;
+  p->query_len = len;
+  p->started = now;
+  p->next = dns->pending;
+  dns->pending = p;
+  dns->pending_count++;
+  dns->forwarded++;
+
+  if (send_upstream(dns, p, now) != 0) {
+    dns->failed++;
+    free_pending(dns, p);
+  }
+}
+
+/**
+ * @param struct dns_state forwarder state.
+ * @param struct pending query whose socket received the message.
+ * @param char message.
+ * @param size_t message size.
+ * @param struct sockaddr_in sender.
+ */
+static void handle_upstream(dns_state *dns, pending *p, unsigned char *msg, size_t len,
+                            const struct sockaddr_in *from) {
+  const struct sockaddr_in *upstream = &dns->upstreams[p->upstream];
+  unsigned char key[DNS_PACKET];
+  size_t key_len;
+
+  if (len < 12 || !(msg[2] & 0x80) || question_key(msg, len, key, &key_len) != 0) return;
+
+  uint16_t id = (msg[0] << 8) | msg[1];
+
+  // ID, question and sender all have to match, anything else is spoofed or stale.
+  // The EDNS of the answer is the one of the upstream, the key keeps the client's.
+  if (p->upstream_id != id || p->key_len != key_len || memcmp(p->key, key, key_len - EDNS_KEY) != 0 ||
+      from->sin_addr.s_addr != upstream->sin_addr.s_addr || from->sin_port != upstream->sin_port)
+    return;
+
+  long now = now_ms();
+  dns->upstream_ms += now - p->started;
+
+  // A truncated answer isn't cached, the client asks again over TCP.
+  cache_store(dns, p->key, p->key_len, msg, len, now);
+  for (size_t i = 0; i < p->count; i++) reply(dns, msg, len, &p->waiters[i]);
+
+  free_pending(dns, p);
+}
+
+/**
+ * Moves timed out queries to the next upstream, or answers SERVFAIL
+ * once every upstream has been tried.
+ *
+ * @param struct dns_state forwarder state.
+ * @return milliseconds until the next deadline.
+ */
+static int handle_timeouts(dns_state *dns) {
+  long now = now_ms(), next = now + DNS_TIMEOUT_MS;
+
+  for (pending *p = dns->pending, *following; p != NULL; p = following) {
+    following = p->next;
+
+    if (p->deadline > now) {
+      if (p->deadline < next) next = p->deadline;
+      continue;
+    }
+
+    if (++p->upstream < dns->upstreams_count && send_upstream(dns, p, now) == 0) {
+      if (p->deadline < next) next = p->deadline;
+      continue;
+    }
+
+    unsigned char answer[DNS_PACKET];
+    memcpy(answer, p->query, p->query_len);
+    answer[2] |= 0x80;
+    answer[3] = (answer[3] & 0xf0) | 2;
+    for (size_t i = 0; i < p->count; i++) reply(dns, answer, p->query_len, &p->waiters[i]);
+
+    dns->failed++;
+    free_pending(dns, p);
+  }
+
+  return (int)(next - now);
+}
+
+/**
+ * @param struct dns_state forwarder state.
+ * @param char comma separated upstreams.
+ * @return 0 if successful and 1 on error.
+ */
+static int parse_upstreams(dns_state *dns, const char *upstreams) {
+  char list[512];
+  snprintf(list, 512, "%s", upstreams);
+
+  for (char *save = NULL, *item = strtok_r(list, ",", &save);
+       item != NULL && dns->upstreams_count < DNS_MAX_UPSTREAMS; item = strtok_r(NULL, ",", &save)) {
+    if (parse_address(item, DNS_PORT, &dns->upstreams[dns->upstreams_count]) != 0) {
+      fprintf(stderr, "dns: wrong upstream %s\n", item);
+      return 1;
+    }
+    dns->upstreams_count++;
+  }
+
+  return dns->upstreams_count == 0 ? 1 : 0;
+}
+
+/**
+ * write() until the whole buffer is sent.
+ *
+ * @param int socket.
+ * @param char data.
+ * @param size_t data size.
+ * @return 0 if successful and 1 on error.
+ */
+static int write_all(int fd, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      return 1;
+    }
+    data += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ * TCP is a pass-through for answers too large for UDP: the connection
+ * is relayed to the first upstream that accepts it, nothing is cached.
+ * Runs in a child process, so a slow client never blocks the UDP path.
+ *
+ * @param struct dns_state forwarder state.
+ * @param int accepted client connection.
+ */
+static void tcp_relay(const dns_state *dns, int client) {
+  struct timeval timeout = {DNS_TIMEOUT_MS / 1000, (DNS_TIMEOUT_MS % 1000) * 1000};
+  int upstream = -1;
+
+  for (int i = 0; i < dns->upstreams_count && upstream == -1; i++) {
+    upstream = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (upstream == -1) return;
+    // connect() gives up after SO_SNDTIMEO, the next upstream is tried.
+    setsockopt(upstream, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(upstream, (const struct sockaddr*)&dns->upstreams[i], sizeof(struct sockaddr_in)) != 0) {
+      close(upstream);
+      upstream = -1;
+    }
+  }
+  if (upstream == -1) return;
+
+  unsigned char buffer[DNS_PACKET];
+  struct pollfd fds[2] = {{client, POLLIN, 0}, {upstream, POLLIN, 0}};
+
+  // Either side closing or DNS_TCP_IDLE_MS of silence ends the connection.
+  while (poll(fds, 2, DNS_TCP_IDLE_MS) > 0) {
+    int from = fds[0].revents != 0 ? 0 : 1;
+    ssize_t n = read(fds[from].fd, buffer, DNS_PACKET);
+    if (n <= 0 || write_all(fds[!from].fd, buffer, n) != 0) break;
+  }
+
+  close(upstream);
+}
+
+/**
+ * The sd_notify() protocol without libsystemd: one datagram to NOTIFY_SOCKET.
+ * systemd-run -p Type=notify waits for it, a forwarder that can't bind
+ * exits first and the PostUp fails.
+ */
+static void notify_ready(void) {
+  const char *path = getenv("NOTIFY_SOCKET");
+  struct sockaddr_un addr = {0};
+
+  if (path == NULL || (path[0] != '/' && path[0] != '@') || strlen(path) >= sizeof(addr.sun_path))
+    return;
+
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path, strlen(path));
+  // An abstract socket starts with a zero byte.
+  if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0';
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) return;
+  if (sendto(fd, "READY=1", 7, 0, (const struct sockaddr*)&addr,
+             offsetof(struct sockaddr_un, sun_path) + strlen(path)) == -1)
+    perror("dns: systemd notification error");
+  close(fd);
+}
+
+/**
+ * @param struct sockaddr_in listen address.
+ * @param int SOCK_DGRAM or SOCK_STREAM.
+ * @return bound socket or -1 on error.
+ */
+static int listen_socket(const struct sockaddr_in *addr, int type) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0), on = 1;
+  if (fd == -1) {
+    perror("dns: socket error");
+    return -1;
+  }
+
+  if (type == SOCK_STREAM) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (bind(fd, (const struct sockaddr*)addr, sizeof(*addr)) != 0 ||
+      (type == SOCK_STREAM && listen(fd, 64) != 0)) {
+    perror("dns: bind error");
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+int dns_forwarder(const char *listen, const char *upstreams) {
+  static dns_state dns;
+  static struct pollfd fds[2 + DNS_MAX_PENDING];
+  static pending *polled[DNS_MAX_PENDING];
+  struct sockaddr_in addr;
+  char address[64];
+
+  memset(&dns, 0, sizeof(dns));
+
+  // A server name listens on the tunnel address that wg_init_settings_server() gave it.
+  if (!isdigit((unsigned char)listen[0])) {
+    int server_number = 0;
+    for (const char *s = listen; *s != '\0'; s++)
+      if (isdigit((unsigned char)*s))
+        server_number = server_number * 10 + (*s - '0');
+    snprintf(address, 64, "10.0.%d.1", server_number);
+  } else {
+    snprintf(address, 64, "%s", listen);
+  }
+
+  if (parse_address(address, DNS_PORT, &addr) != 0 ||
+      parse_upstreams(&dns, upstreams != NULL ? upstreams : DNS_UPSTREAMS) != 0) {
+    fprintf(stderr, "dns: wrong listen address or upstreams\n");
+    return 1;
+  }
+
+  dns.listen_fd = listen_socket(&addr, SOCK_DGRAM);
+  dns.tcp_fd = dns.listen_fd != -1 ? listen_socket(&addr, SOCK_STREAM) : -1;
+  if (dns.tcp_fd == -1) {
+    if (dns.listen_fd != -1) close(dns.listen_fd);
+    return 1;
+  }
+
+  struct sigaction action = {0};
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  action.sa_handler = on_child;
+  sigaction(SIGCHLD, &action, NULL);
+
+  // The signals only get through inside ppoll(), none is lost between a check and the wait.
+  sigset_t blocked, unblocked;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &blocked, &unblocked);
+
+  printf("dns forwarder is listening on ");
+  printf("\033[32m%s\033[0m", address);
+  printf(" (udp and tcp)\n");
+  fflush(stdout);
+  notify_ready();
+
+  unsigned char msg[DNS_PACKET];
+  struct sockaddr_in from;
+  socklen_t from_len;
+  int timeout = DNS_TIMEOUT_MS;
+
+  while (!stop) {
+    while (waitpid(-1, NULL, WNOHANG) > 0) dns.relays--;
+
+    nfds_t count = 2;
+    fds[0] = (struct pollfd){dns.listen_fd, POLLIN, 0};
+    // At DNS_TCP_MAX relays the connections queue up until one of them has ended.
+    fds[1] = (struct pollfd){dns.tcp_fd, dns.relays < DNS_TCP_MAX ? POLLIN : 0, 0};
+    for (pending *p = dns.pending; p != NULL; p = p->next) {
+      polled[count - 2] = p;
+      fds[count++] = (struct pollfd){p->fd, POLLIN, 0};
+    }
+
+    struct timespec wait = {timeout / 1000, (timeout % 1000) * 1000000L};
+    int ready = ppoll(fds, count, dns.pending != NULL ? &wait : NULL, &unblocked);
+    if (ready == -1) {
+      if (errno == EINTR) continue;
+      perror("dns: poll error");
+      break;
+    }
+
+    // Answers first: nothing is freed before every polled query has been looked at.
+    for (nfds_t i = 2; i < count; i++) {
+      if (!(fds[i].revents & POLLIN)) continue;
+      from_len = sizeof(from);
+      ssize_t n = recvfrom(fds[i].fd, msg, DNS_PACKET, 0, (struct sockaddr*)&from, &from_len);
+      if (n > 0) handle_upstream(&dns, polled[i - 2], msg, n, &from);
+    }
+
+    if (fds[0].revents & POLLIN) {
+      from_len = sizeof(from);
+      ssize_t n = recvfrom(dns.listen_fd, msg, DNS_PACKET, 0, (struct sockaddr*)&from, &from_len);
+      if (n > 0) handle_client(&dns, msg, n, &from);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int client = accept4(dns.tcp_fd, NULL, NULL, SOCK_CLOEXEC);
+      if (client != -1) {
+        pid_t pid = fork();
+        if (pid == 0) {
+          // A relay ends with the forwarder when systemd stops it.
+          signal(SIGINT, SIG_DFL);
+          signal(SIGTERM, SIG_DFL);
+          sigprocmask(SIG_SETMASK, &unblocked, NULL);
+          tcp_relay(&dns, client);
+          _exit(0);
+        }
+        if (pid > 0) {
+          dns.tcp++;
+          dns.relays++;
+        }
+        close(client);
+      }
+    }
+
+    timeout = handle_timeouts(&dns);
+  }
+
+  unsigned long answered = dns.hits + dns.coalesced;
+  printf("queries: %lu, cache hits: %lu, coalesced: %lu, upstream: %lu, failed: %lu, tcp: %lu\n",
+    dns.queries, dns.hits, dns.coalesced, dns.forwarded, dns.failed, dns.tcp);
+  printf("hit rate: ");
+  printf("\033[32m%.1f%%\033[0m", dns.queries ? 100.0 * answered / dns.queries : 0.0);
+  printf(", average upstream latency: %ld ms\n",
+    dns.forwarded - dns.failed ? dns.upstream_ms / (long)(dns.forwarded - dns.failed) : 0);
+
+  while (dns.pending != NULL) free_pending(&dns, dns.pending);
+  for (size_t i = 0; i < DNS_CACHE_SIZE; i++) {
+    while (dns.cache[i] != NULL) {
+      cache_entry *entry = dns.cache[i];
+      dns.cache[i] = entry->next;
+      free_entry(entry);
+    }
+  }
+
+  close(dns.listen_fd);
+  close(dns.tcp_fd);
+  sigprocmask(SIG_SETMASK, &unblocked, NULL);
+
+  return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef DNS_H
+#define DNS_H
+
+#define DNS_PORT 53
+#define DNS_UPSTREAMS "1.1.1.1,9.9.9.9"
+
+// Cached answers, a lookup never waits longer than DNS_TIMEOUT_MS for one upstream.
+#define DNS_CACHE_SIZE 4096
+#define DNS_TIMEOUT_MS 2000
+#define DNS_MAX_TTL 86400
+// TCP connections are relayed until they have been silent this long.
+#define DNS_TCP_IDLE_MS 10000
+// Relays running at once, further connections wait in the listen backlog.
+#define DNS_TCP_MAX 64
+
+/**
+ * Caching forwarder for the clients of one server. Identical questions
+ * that arrive while one is already upstream share its answer. TCP is
+ * relayed to the upstreams as it is, for answers truncated over UDP.
+ * Started by the PostUp of servers added with local, tells systemd once
+ * it listens, runs until SIGINT or SIGTERM and prints the hit rate on exit.
+ *
+ * @param char wg interface name (listens on 10.0.x.1) or ip[:port].
+ * @param char comma separated upstreams ip[:port] or NULL for DNS_UPSTREAMS.
+ * @return 0 after a signal and 1 on error.
+ */
+int dns_forwarder(const char *listen, const char *upstreams);
+
+#endif
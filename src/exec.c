@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <spawn.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#ifdef SDBUS
+  #include <systemd/sd-bus.h>
+#endif
+
+#include "exec.h"
+
+extern char **environ;
+
+/**
+ * @param pid_t spawned process.
+ * @return 0 if the process exited with 0 and 1 otherwise.
+ */
+static int wait_child(pid_t pid) {
+  int status;
+
+  while (waitpid(pid, &status, 0) == -1) {
+    if (errno != EINTR) {
+      perror("waitpid error");
+      return 1;
+    }
+  }
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
+
+static int spawn_run(char *const argv[], int quiet) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+
+  if (quiet) {
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+  }
+
+  // The child shares our stdout, anything still buffered would come out after it.
+  fflush(stdout);
+
+  pid_t pid;
+  int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  if (err != 0) {
+    errno = err;
+    perror(argv[0]);
+    return 1;
+  }
+
+  return wait_child(pid);
+}
+
+static int spawn_capture(char *const argv[], const char *input, size_t input_size,
+                         char **output, size_t *output_size) {
+  int in[2], out[2];
+
+  *output = NULL;
+  *output_size = 0;
+
+  if (pipe2(in, O_CLOEXEC) != 0) {
+    perror("pipe error");
+    return 1;
+  }
+  if (pipe2(out, O_CLOEXEC) != 0) {
+    perror("pipe error");
+    close(in[0]);
+    close(in[1]);
+    return 1;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+
+  pid_t pid;
+  int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  close(in[0]);
+  close(out[1]);
+
+  if (err != 0) {
+    errno = err;
+    perror(argv[0]);
+    close(in[1]);
+    close(out[0]);
+    return 1;
+  }
+
+  // A child that exits without reading its stdin must not kill us.
+  struct sigaction ignore = {0}, previous;
+  ignore.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &ignore, &previous);
+
+  size_t written = 0, capacity = 0;
+  int status = 0;
+
+  if (input == NULL || input_size == 0) {
+    close(in[1]);
+    in[1] = -1;
+  }
+
+  // stdin and stdout are served together so a large input can't deadlock the pipes.
+  while (out[0] != -1) {
+    struct pollfd fds[2] = {{out[0], POLLIN, 0}, {in[1], POLLOUT, 0}};
+
+    if (poll(fds, in[1] == -1 ? 1 : 2, -1) == -1) {
+      if (errno == EINTR) continue;
+      perror("poll error");
+      status = 1;
+      break;
+    }
+
+    if (in[1] != -1 && fds[1].revents) {
+      ssize_t n = write(in[1], input + written, input_size - written);
+      if (n > 0) written += n;
+      if (n == -1 || written == input_size) {
+        close(in[1]);
+        in[1] = -1;
+      }
+    }
+
+    if (fds[0].revents) {
+      if (*output_size + 4096 + 1 > capacity) {
+        capacity = capacity ? capacity * 2 : 8192;
+        char *ptr_new = realloc(*output, capacity);
+        if (ptr_new == NULL) {
+          perror("output: memory allocation error");
+          status = 1;
+          break;
+        }
+        *output = ptr_new;
+      }
+
+      ssize_t n = read(out[0], *output + *output_size, 4096);
+      if (n > 0) {
+        *output_size += n;
+      } else if (n == 0 || errno != EINTR) {
+        close(out[0]);
+        out[0] = -1;
+      }
+    }
+  }
+
+  if (in[1] != -1) close(in[1]);
+  if (out[0] != -1) close(out[0]);
+
+  sigaction(SIGPIPE, &previous, NULL);
+
+  if (wait_child(pid) != 0) status = 1;
+
+  if (*output != NULL) {
+    (*output)[*output_size] = '\0';
+  } else if (status == 0) {
+    *output = calloc(1, 1);
+  }
+
+  if (status != 0) {
+    free(*output);
+    *output = NULL;
+    *output_size = 0;
+  }
+
+  return status;
+}
+
+static int spawn_pipe_open(char *const argv[], int output_fd, int *input_fd, pid_t *pid) {
+  int in[2];
+
+  if (pipe2(in, O_CLOEXEC) != 0) {
+    perror("pipe error");
+    return 1;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, output_fd, STDOUT_FILENO);
+
+  int err = posix_spawnp(pid, argv[0], &actions, NULL, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+
+  close(in[0]);
+
+  if (err != 0) {
+    errno = err;
+    perror(argv[0]);
+    close(in[1]);
+    return 1;
+  }
+
+  *input_fd = in[1];
+
+  return 0;
+}
+
+static int spawn_pipe_close(int input_fd, pid_t pid) {
+  if (input_fd != -1) close(input_fd);
+
+  return wait_child(pid);
+}
+
+int exec_unit_name(const char *unit, char *name, size_t size) {
+  static const char *types[] = {".service", ".socket", ".device", ".mount", ".automount",
+    ".swap", ".target", ".path", ".timer", ".slice", ".scope"};
+  const char *dot = strrchr(unit, '.');
+  const char *suffix = ".service";
+
+  for (size_t i = 0; dot != NULL && i < sizeof(types) / sizeof(types[0]); i++)
+    if (strcmp(dot, types[i]) == 0) suffix = "";
+
+  return (size_t)snprintf(name, size, "%s%s", unit, suffix) >= size ? 1 : 0;
+}
+
+#ifdef SDBUS
+/**
+ * Unit files change on disk, systemd has to re-read them like systemctl does.
+ *
+ * @param struct sd_bus connection to the system bus.
+ * @param char Manager method: EnableUnitFiles or DisableUnitFiles.
+ * @param char unit name.
+ * @return 0 if successful and 1 on error.
+ */
+static int sdbus_unit_files(sd_bus *bus, const char *method, const char *unit) {
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+  int r;
+
+  if (strcmp(method, "EnableUnitFiles") == 0)
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", method, &error, NULL, "asbb", 1, unit, 0, 0);
+  else
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", method, &error, NULL, "asb", 1, unit, 0);
+
+  if (r >= 0)
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", "Reload", &error, NULL, "");
+
+  if (r < 0) fprintf(stderr, "%s: %s\n", method, error.message ? error.message : strerror(-r));
+  sd_bus_error_free(&error);
+
+  return r < 0 ? 1 : 0;
+}
+
+typedef struct {
+  char *path;
+  int finished;
+  char result[32];
+} sdbus_job;
+
+/**
+ * JobRemoved handler, picks the signal of our own job.
+ *
+ * @param struct sd_bus_message JobRemoved signal: id, job path, unit, result.
+ * @param void struct sdbus_job that is waited for.
+ * @param struct sd_bus_error unused.
+ * @return 0 to let other handlers see the signal.
+ */
+static int sdbus_job_removed(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+  sdbus_job *job = userdata;
+  const char *path, *unit, *result;
+  uint32_t id;
+
+  (void)error;
+  if (sd_bus_message_read(message, "uoss", &id, &path, &unit, &result) < 0) return 0;
+
+  if (job->path != NULL && strcmp(job->path, path) == 0) {
+    snprintf(job->result, 32, "%s", result);
+    job->finished = 1;
+  }
+
+  return 0;
+}
+
+/**
+ * StartUnit returns as soon as the job is queued, wg-quick may still fail.
+ * Like systemctl, the call waits for JobRemoved and checks the result.
+ *
+ * @param struct sd_bus connection to the system bus.
+ * @param char Manager method: StartUnit or StopUnit.
+ * @param char unit name.
+ * @return 0 if the job finished with "done" and 1 otherwise.
+ */
+static int sdbus_unit_job(sd_bus *bus, const char *method, const char *unit) {
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+  sd_bus_message *reply = NULL;
+  sd_bus_slot *slot = NULL;
+  sdbus_job job = {NULL, 0, ""};
+  const char *path;
+
+  // The match has to be in place before the job exists, a quick job would be missed.
+  int r = sd_bus_match_signal(bus, &slot, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+    "org.freedesktop.systemd1.Manager", "JobRemoved", sdbus_job_removed, &job);
+
+  // systemd only sends job signals once some client has subscribed.
+  if (r >= 0)
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", "Subscribe", &error, NULL, "");
+
+  if (r >= 0)
+    r = sd_bus_call_method(bus, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", method, &error, &reply, "ss", unit, "replace");
+
+  if (r >= 0) r = sd_bus_message_read(reply, "o", &path);
+  if (r >= 0 && (job.path = strdup(path)) == NULL) r = -ENOMEM;
+
+  while (r >= 0 && !job.finished) {
+    r = sd_bus_process(bus, NULL);
+    if (r == 0) r = sd_bus_wait(bus, UINT64_MAX);
+  }
+
+  if (r < 0) fprintf(stderr, "%s: %s\n", method, error.message ? error.message : strerror(-r));
+  else if (strcmp(job.result, "done") != 0)
+    fprintf(stderr, "%s: the job of %s finished with %s\n", method, unit, job.result);
+
+  free(job.path);
+  sd_bus_message_unref(reply);
+  sd_bus_slot_unref(slot);
+  sd_bus_error_free(&error);
+
+  return r < 0 || strcmp(job.result, "done") != 0 ? 1 : 0;
+}
+
+static int sdbus_unit_start(const char *unit) {
+  sd_bus *bus = NULL;
+  char name[256];
+
+  if (exec_unit_name(unit, name, 256) != 0) {
+    fprintf(stderr, "unit name %s is too long\n", unit);
+    return 1;
+  }
+
+  int r = sd_bus_open_system(&bus);
+  if (r < 0) {
+    errno = -r;
+    perror("couldn't connect to the system bus");
+    return 1;
+  }
+
+  int status = sdbus_unit_files(bus, "EnableUnitFiles", name) ||
+               sdbus_unit_job(bus, "StartUnit", name);
+
+  sd_bus_flush_close_unref(bus);
+
+  return status;
+}
+
+static int sdbus_unit_stop(const char *unit) {
+  sd_bus *bus = NULL;
+  char name[256];
+
+  if (exec_unit_name(unit, name, 256) != 0) {
+    fprintf(stderr, "unit name %s is too long\n", unit);
+    return 1;
+  }
+
+  int r = sd_bus_open_system(&bus);
+  if (r < 0) {
+    errno = -r;
+    perror("couldn't connect to the system bus");
+    return 1;
+  }
+
+  int status = sdbus_unit_job(bus, "StopUnit", name) ||
+               sdbus_unit_files(bus, "DisableUnitFiles", name);
+
+  sd_bus_flush_close_unref(bus);
+
+  return status;
+}
+#else
+static int systemctl_unit_start(const char *unit) {
+  char *argv[] = {"systemctl", "enable", "--now", (char*)unit, NULL};
+
+  return spawn_run(argv, 0);
+}
+
+static int systemctl_unit_stop(const char *unit) {
+  char *argv[] = {"systemctl", "disable", "--now", (char*)unit, NULL};
+
+  return spawn_run(argv, 0);
+}
+#endif
+
+static const exec_backend default_backend = {
+  .run = spawn_run,
+  .capture = spawn_capture,
+  .pipe_open = spawn_pipe_open,
+  .pipe_close = spawn_pipe_close,
+  #ifdef SDBUS
+    .unit_start = sdbus_unit_start,
+    .unit_stop = sdbus_unit_stop,
+  #else
+    .unit_start = systemctl_unit_start,
+    .unit_stop = systemctl_unit_stop,
+  #endif
+};
+
+static const exec_backend *current = &default_backend;
+
+void exec_set_backend(const exec_backend *backend) {
+  current = backend != NULL ? backend : &default_backend;
+}
+
+int exec_run(char *const argv[], int quiet) {
+  return current->run(argv, quiet);
+}
+
+int exec_capture(char *const argv[], const char *input, size_t input_size,
+                 char **output, size_t *output_size) {
+  return current->capture(argv, input, input_size, output, output_size);
+}
+
+int exec_pipe_open(char *const argv[], int output_fd, int *input_fd, pid_t *pid) {
+  return current->pipe_open(argv, output_fd, input_fd, pid);
+}
+
+int exec_pipe_close(int input_fd, pid_t pid) {
+  return current->pipe_close(input_fd, pid);
+}
+
+int exec_unit_start(const char *unit) {
+  return current->unit_start(unit);
+}
+
+int exec_unit_stop(const char *unit) {
+  return current->unit_stop(unit);
+}
+
+int exec_read_line(char *const argv[], const char *input, char *line, size_t size) {
+  char *output = NULL;
+  size_t output_size = 0;
+
+  if (exec_capture(argv, input, input ? strlen(input) : 0, &output, &output_size) != 0)
+    return 1;
+
+  output[strcspn(output, "\n")] = '\0';
+  int status = output[0] == '\0' || strlen(output) >= size ? 1 : 0;
+  if (status == 0) snprintf(line, size, "%s", output);
+
+  free(output);
+
+  return status;
+}
@@ -0,0 +1,103 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * Every external program goes through a backend, so nothing is ever
+ * interpolated into a shell and tests can replace the real processes.
+ */
+typedef struct {
+  int (*run)(char *const argv[], int quiet);
+  int (*capture)(char *const argv[], const char *input, size_t input_size,
+                 char **output, size_t *output_size);
+  int (*unit_start)(const char *unit);
+  int (*unit_stop)(const char *unit);
+  int (*pipe_open)(char *const argv[], int output_fd, int *input_fd, pid_t *pid);
+  int (*pipe_close)(int input_fd, pid_t pid);
+} exec_backend;
+
+/**
+ * @param struct exec_backend to use from now on, NULL restores the default one.
+ */
+void exec_set_backend(const exec_backend *backend);
+
+/**
+ * @param char argv array terminated by NULL, argv[0] is searched in PATH.
+ * @param int 1 to send stdout and stderr to /dev/null.
+ * @return 0 if the program exited with 0 and 1 otherwise.
+ */
+int exec_run(char *const argv[], int quiet);
+
+/**
+ * @param char argv array terminated by NULL, argv[0] is searched in PATH.
+ * @param char data for stdin of the program or NULL.
+ * @param size_t size of the data.
+ * @param char pointer to which the stdout of the program will be written, free() it.
+ * @param size_t pointer to which the size of stdout will be written.
+ * @return 0 if the program exited with 0 and 1 otherwise.
+ */
+int exec_capture(char *const argv[], const char *input, size_t input_size,
+                 char **output, size_t *output_size);
+
+/**
+ * Starts a filter that reads from a pipe and writes to output_fd,
+ * for data that is produced piece by piece such as an archive.
+ *
+ * @param char argv array terminated by NULL, argv[0] is searched in PATH.
+ * @param int file descriptor for stdout of the program.
+ * @param int pointer to which the write end of its stdin will be written.
+ * @param pid_t pointer to which the process id will be written.
+ * @return 0 if successful and 1 on error.
+ */
+int exec_pipe_open(char *const argv[], int output_fd, int *input_fd, pid_t *pid);
+
+/**
+ * Closes stdin of the filter and waits for it to finish.
+ *
+ * @param int write end from exec_pipe_open() or -1 if it is already closed.
+ * @param pid_t process id from exec_pipe_open().
+ * @return 0 if the program exited with 0 and 1 otherwise.
+ */
+int exec_pipe_close(int input_fd, pid_t pid);
+
+/**
+ * Enables and starts a systemd unit.
+ *
+ * @param char unit name.
+ * @return 0 if successful and 1 on error.
+ */
+int exec_unit_start(const char *unit);
+
+/**
+ * Stops and disables a systemd unit.
+ *
+ * @param char unit name.
+ * @return 0 if successful and 1 on error.
+ */
+int exec_unit_stop(const char *unit);
+
+/**
+ * systemctl completes wg-quick@wg0 to wg-quick@wg0.service,
+ * the D-Bus API of systemd only knows full unit names.
+ *
+ * @param char unit name with or without its type.
+ * @param char buffer to which the full unit name will be written.
+ * @param size_t size of the buffer.
+ * @return 0 if successful and 1 if the name doesn't fit.
+ */
+int exec_unit_name(const char *unit, char *name, size_t size);
+
+/**
+ * Runs a program that prints one line, like wg genkey.
+ *
+ * @param char argv array terminated by NULL.
+ * @param char data for stdin of the program or NULL.
+ * @param char pointer to which the line without newline will be written.
+ * @param size_t size of the line buffer.
+ * @return 0 if successful and 1 on error.
+ */
+int exec_read_line(char *const argv[], const char *input, char *line, size_t size);
+
+#endif
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "exec.h"
+#include "export.h"
+
+/**
+ * Drops the unfinished archive file, the target keeps its old content.
+ *
+ * @param struct export_archive being opened or closed.
+ */
+static void discard(export_archive *ex) {
+  if (ex->sync_fd != -1) close(ex->sync_fd);
+  ex->sync_fd = -1;
+  if (ex->temp[0] != '\0') unlink(ex->temp);
+}
+
+/**
+ * Replaces the target with the complete archive and makes the rename durable.
+ *
+ * @param struct export_archive being closed.
+ * @return 0 if successful and 1 on error.
+ */
+static int publish(export_archive *ex) {
+  if (rename(ex->temp, ex->target) != 0) {
+    perror("archive renaming error");
+    unlink(ex->temp);
+    return 1;
+  }
+
+  char dir[520];
+  snprintf(dir, sizeof(dir), "%s", ex->target);
+  char *slash = strrchr(dir, '/');
+  if (slash == NULL) snprintf(dir, sizeof(dir), ".");
+  else if (slash == dir) slash[1] = '\0';
+  else *slash = '\0';
+
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1 || fsync(fd) != 0) {
+    perror("archive folder sync error");
+    if (fd != -1) close(fd);
+    return 1;
+  }
+  close(fd);
+
+  return 0;
+}
+
+int export_open(export_archive *ex, const char *target, int qr) {
+  int fd;
+  size_t len = strlen(target);
+
+  ex->qr = qr;
+  ex->gzip_fd = -1;
+  ex->sync_fd = -1;
+  ex->temp[0] = '\0';
+  ex->files = 0;
+  ex->mtime = time(NULL);
+
+  if (strcmp(target, "-") == 0) {
+    // The archive keeps the real stdout, everything ww prints goes to stderr instead.
+    fflush(stdout);
+    fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd == -1 || dup2(STDERR_FILENO, STDOUT_FILENO) == -1) {
+      perror("stdout duplication error");
+      if (fd != -1) close(fd);
+      return 1;
+    }
+  } else {
+    if (len >= sizeof(ex->target)) {
+      fprintf(stderr, "%s: archive name is too long\n", target);
+      return 1;
+    }
+
+    /*
+     * A file is written next to the target and only renamed over it once the
+     * archive is complete, an early failure leaves an existing archive alone.
+     * Devices and pipes are written directly. Every config holds a private key.
+     */
+    struct stat st;
+    if (stat(target, &st) == 0 && !S_ISREG(st.st_mode)) {
+      fd = open(target, O_WRONLY | O_CLOEXEC);
+    } else {
+      snprintf(ex->target, sizeof(ex->target), "%s", target);
+      snprintf(ex->temp, sizeof(ex->temp), "%s.XXXXXX", target);
+      fd = mkostemp(ex->temp, O_CLOEXEC);
+      if (fd == -1) ex->temp[0] = '\0';
+    }
+    if (fd == -1) {
+      perror("archive creation error");
+      return 1;
+    }
+    // gzip writes the file, the copy is only kept to fsync it in export_close().
+    ex->sync_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  }
+
+  if (len > 3 && strcmp(target + len - 3, ".gz") == 0) {
+    char *gzip[] = {"gzip", "-c", NULL};
+    int status = exec_pipe_open(gzip, fd, &ex->gzip_fd, &ex->gzip_pid);
+    close(fd);
+    if (status != 0) {
+      discard(ex);
+      return 1;
+    }
+    fd = ex->gzip_fd;
+  }
+
+  ex->out = fdopen(fd, "w");
+  if (ex->out == NULL) {
+    perror("archive openning error");
+    close(fd);
+    if (ex->gzip_fd != -1) exec_pipe_close(-1, ex->gzip_pid);
+    discard(ex);
+    return 1;
+  }
+  setvbuf(ex->out, NULL, _IOFBF, EXPORT_BUFFER);
+
+  return 0;
+}
+
+int export_add(export_archive *ex, const char *name, const char *data, size_t size) {
+  char header[EXPORT_BLOCK] = {0};
+
+  if (strlen(name) >= 100) {
+    fprintf(stderr, "%s: name is too long for the archive\n", name);
+    return 1;
+  }
+
+  // ustar header: numbers are octal text, the checksum is counted with its own field as spaces.
+  memcpy(header, name, strlen(name));
+  snprintf(header + 100, 8, "%07o", 0600);
+  snprintf(header + 108, 8, "%07o", 0);
+  snprintf(header + 116, 8, "%07o", 0);
+  snprintf(header + 124, 12, "%011lo", (unsigned long)size);
+  snprintf(header + 136, 12, "%011lo", (unsigned long)ex->mtime);
+  memset(header + 148, ' ', 8);
+  header[156] = '0';
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+
+  unsigned int sum = 0;
+  for (int i = 0; i < EXPORT_BLOCK; i++) sum += (unsigned char)header[i];
+  snprintf(header + 148, 7, "%06o", sum);
+
+  static const char padding[EXPORT_BLOCK] = {0};
+  size_t rest = (EXPORT_BLOCK - size % EXPORT_BLOCK) % EXPORT_BLOCK;
+
+  if (fwrite(header, 1, EXPORT_BLOCK, ex->out) != EXPORT_BLOCK ||
+      fwrite(data, 1, size, ex->out) != size ||
+      fwrite(padding, 1, rest, ex->out) != rest) {
+    perror("archive writing error");
+    return 1;
+  }
+
+  ex->files++;
+
+  return 0;
+}
+
+int export_client(export_archive *ex, wireguard_settings *wgs, const char *publicip,
+                  const char *issue) {
+  char *conf = NULL, name[128];
+  size_t size = 0;
+
+  FILE *fp = open_memstream(&conf, &size);
+  if (fp == NULL) {
+    perror("config: memory allocation error");
+    return 1;
+  }
+  wg_write_config_client(fp, wgs, publicip, issue);
+  if (fclose(fp) != 0) {
+    perror("config: memory allocation error");
+    free(conf);
+    return 1;
+  }
+
+  snprintf(name, 128, "%s.conf", wgs->name);
+  int status = export_add(ex, name, conf, size);
+
+  if (status == 0 && ex->qr) {
+    char *qrencode[] = {"qrencode", "-t", "PNG", "-o", "-", NULL};
+    char *png = NULL;
+    size_t png_size = 0;
+
+    if (exec_capture(qrencode, conf, size, &png, &png_size) == 0) {
+      snprintf(name, 128, "%s.png", wgs->name);
+      status = export_add(ex, name, png, png_size);
+    } else {
+      fprintf(stderr, "couldn't generate qrcode for %s\n", wgs->name);
+      status = 1;
+    }
+    free(png);
+  }
+
+  free(conf);
+
+  if (status == 0) {
+    printf("\033[32m%s.conf\033[0m", wgs->name);
+    printf(" has been added to the archive\n");
+  }
+
+  return status;
+}
+
+int export_close(export_archive *ex) {
+  static const char end[2 * EXPORT_BLOCK] = {0};
+  int status = 0;
+
+  // Two empty blocks end a tar archive.
+  if (fwrite(end, 1, sizeof(end), ex->out) != sizeof(end)) status = 1;
+  if (fclose(ex->out) != 0) status = 1;
+  if (status != 0) perror("archive writing error");
+
+  if (ex->gzip_fd != -1 && exec_pipe_close(-1, ex->gzip_pid) != 0) {
+    fprintf(stderr, "gzip failed\n");
+    status = 1;
+  }
+
+  // The journal forgets the intents after this, the configs have to survive a power loss.
+  if (status == 0 && ex->sync_fd != -1 && fsync(ex->sync_fd) != 0 && errno != EINVAL) {
+    perror("archive sync error");
+    status = 1;
+  }
+
+  if (status != 0 || (ex->temp[0] != '\0' && ex->files == 0)) {
+    if (status == 0) {
+      printf("nothing was exported, ");
+      printf("\033[31m%s\033[0m", ex->target);
+      printf(" is unchanged\n");
+    }
+    discard(ex);
+    return status;
+  }
+
+  if (ex->sync_fd != -1) close(ex->sync_fd);
+  if (ex->temp[0] != '\0' && publish(ex) != 0) return 1;
+
+  printf("\033[32m%zu\033[0m", ex->files);
+  printf(" files have been exported\n");
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "wireguard.h"
+
+// ustar works in 512 byte blocks, the stream buffer holds many of them.
+#define EXPORT_BLOCK 512
+#define EXPORT_BUFFER 65536
+
+typedef struct {
+  FILE *out;
+  int qr;
+  int gzip_fd;
+  int sync_fd;
+  char target[512];
+  char temp[520];
+  pid_t gzip_pid;
+  time_t mtime;
+  size_t files;
+} export_archive;
+
+/**
+ * Opens a tar archive for the client configs. "-" is stdout, then the
+ * messages of ww go to stderr. A name ending in .gz is compressed by gzip.
+ * A file is written under a temporary name and replaces the target only
+ * when export_close() succeeds with at least one file in the archive.
+ *
+ * @param struct export_archive to initialize.
+ * @param char file name or "-".
+ * @param int 1 to add a QR code PNG next to every config.
+ * @return 0 if successful and 1 on error.
+ */
+int export_open(export_archive *ex, const char *target, int qr);
+
+/**
+ * @param struct export_archive opened with export_open().
+ * @param char file name in the archive, at most 100 bytes.
+ * @param char file content.
+ * @param size_t size of the content.
+ * @return 0 if successful and 1 on error.
+ */
+int export_add(export_archive *ex, const char *name, const char *data, size_t size);
+
+/**
+ * Writes <name>.conf and with qr also <name>.png without touching the disk.
+ *
+ * @param struct export_archive opened with export_open().
+ * @param struct wireguard_settings with all user information.
+ * @param char public ip from get_ip_address().
+ * @param char yes/no/local to the question about adding dns.
+ * @return 0 if successful and 1 on error.
+ */
+int export_client(export_archive *ex, wireguard_settings *wgs, const char *publicip,
+                  const char *issue);
+
+/**
+ * Ends the archive, waits for gzip, syncs an archive file to disk and
+ * renames it over the target. A failed or empty archive is dropped.
+ *
+ * @param struct export_archive opened with export_open().
+ * @return 0 if successful and 1 on error.
+ */
+int export_close(export_archive *ex);
+
+#endif
@@ -0,0 +1,733 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "tc.h"
+#include "mask.h"
+#include "journal.h"
+
+/**
+ * @param char pointer to which the journal path will be written.
+ */
+static void journal_path(char *path) {
+  #ifdef TEMPDIR
+    snprintf(path, 256, "%s%s", TMP_JOURNAL_PATH, JOURNAL_FILE);
+  #else
+    snprintf(path, 256, "%s%s", JOURNAL_PATH, JOURNAL_FILE);
+  #endif
+}
+
+/**
+ * @param struct timespec start of the interval.
+ * @return milliseconds elapsed since start.
+ */
+static long elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+#ifdef TEMPDIR
+/**
+ * Kill point for the crash tests, see journal_commit().
+ *
+ * @param char step that has just been finished.
+ */
+static void crash_point(const char *step) {
+  const char *crash = getenv("WW_CRASH");
+  if (crash != NULL && strcmp(crash, step) == 0) abort();
+}
+#else
+  #define crash_point(step)
+#endif
+
+/**
+ * write() until the whole buffer is in the journal.
+ *
+ * @param int journal file descriptor.
+ * @param char record line.
+ * @return 0 if successful and 1 on error.
+ */
+static int journal_write(int fd, const char *line) {
+  size_t len = strlen(line);
+
+  while (len > 0) {
+    ssize_t n = write(fd, line, len);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      perror("journal writing error");
+      return 1;
+    }
+    line += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/**
+ * Done and abort markers need no sync of their own: replaying a finished
+ * operation is harmless and an impossible one is aborted again.
+ *
+ * @param int journal file descriptor.
+ * @param char 'D' for done or 'A' for aborted.
+ * @param unsigned long seq of the intent.
+ * @return 0 if successful and 1 on error.
+ */
+static int journal_mark(int fd, char type, unsigned long seq) {
+  char line[64];
+  snprintf(line, 64, "%c\t%lu\n", type, seq);
+
+  return journal_write(fd, line);
+}
+
+/**
+ * @param char server name.
+ * @param char pointer to which the server config path will be written.
+ */
+static void config_path(const char *server, char *conf) {
+  #ifdef TEMPDIR
+    snprintf(conf, 512, "%s%s.conf", TMP_WG_PATH, server);
+  #else
+    snprintf(conf, 512, "%s%s.conf", WG_PATH, server);
+  #endif
+}
+
+static int default_sync(int fd, const char *path) {
+  (void)path;
+  return fsync(fd);
+}
+
+static int (*sync_file)(int fd, const char *path) = default_sync;
+
+void journal_set_sync(int (*sync)(int fd, const char *path)) {
+  sync_file = sync != NULL ? sync : default_sync;
+}
+
+/**
+ * @param char path of a config written by the group.
+ * @return 0 if successful and 1 on error.
+ */
+static int journal_sync_file(const char *path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror("file openning error");
+    return 1;
+  }
+
+  int status = 0;
+  if (sync_file(fd, path) != 0) {
+    perror("config sync error");
+    status = 1;
+  }
+
+  close(fd);
+
+  return status;
+}
+
+/**
+ * @param char list id from journal_save_list().
+ * @param char pointer to which the list path will be written.
+ */
+static void list_path(const char *id, char *path) {
+  #ifdef TEMPDIR
+    snprintf(path, 256, "%sallowed.%s", TMP_JOURNAL_PATH, id);
+  #else
+    snprintf(path, 256, "%sallowed.%s", JOURNAL_PATH, id);
+  #endif
+}
+
+/**
+ * @param char list id from journal_save_list().
+ * @return the AllowedIPs list to free() or NULL on error.
+ */
+static char *journal_load_list(const char *id) {
+  char path[256];
+  list_path(id, path);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("file reading error");
+    return NULL;
+  }
+
+  char *list = NULL;
+  size_t len = 0;
+
+  if (getline(&list, &len, file) == -1) {
+    free(list);
+    list = NULL;
+  } else {
+    list[strcspn(list, "\n")] = '\0';
+  }
+
+  fclose(file);
+
+  return list;
+}
+
+/**
+ * @param char list of unique server names.
+ * @param int number of names in the list.
+ * @param char server name to add.
+ */
+static void remember_server(char servers[][16], int *count, const char *server) {
+  for (int i = 0; i < *count; i++)
+    if (strcmp(servers[i], server) == 0) return;
+
+  if (*count < JOURNAL_SERVERS) snprintf(servers[(*count)++], 16, "%s", server);
+}
+
+/**
+ * Idempotent: a client whose public key is already in the server config
+ * keeps its address and only gets the client config rewritten.
+ *
+ * @param struct journal_record operation to apply.
+ * @param struct export_archive for the client config or NULL for /tmp.
+ * @param struct wg_address_pool of the server, the new address is marked in it.
+ * @param char AllowedIPs of the peer with the same key, "" if there is none yet.
+ *        The new address is written there once the peer has been added.
+ *        The tier is left to journal_apply_group().
+ * @return 0 if applied, JOURNAL_RETRY after a failure that may pass and
+ *         JOURNAL_ABORT if the operation can never be applied.
+ */
+static int journal_apply(const journal_record *rec, export_archive *archive,
+                         wg_address_pool *pool, char *allowed) {
+  wireguard_settings* wgs = (wireguard_settings*)malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) {
+    perror("journal wgs: memory allocation error");
+    return JOURNAL_RETRY;
+  }
+  wg_settings_init(wgs);
+
+  snprintf(wgs->name, 64, "%s", rec->name);
+  snprintf(wgs->priv_key_hash, 64, "%s", rec->priv_key_hash);
+  snprintf(wgs->pub_key_hash, 64, "%s", rec->pub_key_hash);
+  snprintf(wgs->pub_temp_hash, 64, "%s", rec->pub_temp_hash);
+  snprintf(wgs->port, 32, "%d", PORT+pool->server_number);
+  wgs->keepalive = rec->keepalive;
+
+  int found = allowed[0] != '\0';
+  if (found) {
+    snprintf(wgs->subnetwork, 64, "%s", allowed);
+  } else if (wg_pool_allocate(pool, wgs->subnetwork) != 0) {
+    // A full server won't change by retrying, the client is dropped.
+    fprintf(stderr, "journal: %s can't be added, %s is full\n", rec->name, rec->server);
+    wg_settings_free_memory(wgs);
+    return JOURNAL_ABORT;
+  }
+
+  if (strcmp(rec->allowed, "-") != 0) {
+    wgs->allowed_ips = journal_load_list(rec->allowed);
+    if (wgs->allowed_ips == NULL) {
+      wg_settings_free_memory(wgs);
+      return JOURNAL_RETRY;
+    }
+  }
+
+  /*
+   * A failure anywhere leaves the intent without a done marker. The peer may
+   * already be in the server config, then the replay only writes the client config.
+   */
+  int status = found ? 0 : wg_add_client_in_config(wgs, rec->server);
+  if (status == 0 && !found) snprintf(allowed, 64, "%s", wgs->subnetwork);
+  if (status == 0 && archive != NULL)
+    status = export_client(archive, wgs, rec->publicip, rec->issue);
+  else if (status == 0)
+    status = wg_create_config_client(wgs, rec->publicip, rec->issue);
+
+  wg_settings_free_memory(wgs);
+
+  return status == 0 ? 0 : JOURNAL_RETRY;
+}
+
+/**
+ * Applies the operations server by server. Each server config is read once
+ * for the whole group, that read finds the peers already added and the
+ * free addresses at the same time. The tiers file is rewritten once per server.
+ *
+ * @param struct journal_record operations to apply, at most JOURNAL_GROUP_MAX.
+ * @param int number of operations.
+ * @param struct export_archive for the client configs or NULL for /tmp.
+ * @param int pointer to which the journal_apply() result of each operation will be written.
+ */
+static void journal_apply_group(const journal_record *records, int count,
+                                export_archive *archive, int *results) {
+  const char *keys[JOURNAL_GROUP_MAX];
+  char allowed[JOURNAL_GROUP_MAX][64];
+  int members[JOURNAL_GROUP_MAX];
+  tc_peer peers[JOURNAL_GROUP_MAX];
+
+  wg_address_pool *pool = malloc(sizeof(wg_address_pool));
+
+  for (int i = 0; i < count; i++) results[i] = -1;
+
+  for (int i = 0; i < count; i++) {
+    if (results[i] != -1) continue;
+
+    int n = 0;
+    for (int j = i; j < count; j++) {
+      if (results[j] == -1 && strcmp(records[j].server, records[i].server) == 0) {
+        members[n] = j;
+        keys[n++] = records[j].pub_key_hash;
+      }
+    }
+
+    char conf[512];
+    config_path(records[i].server, conf);
+
+    // A deleted server won't come back by retrying, its clients are dropped.
+    int status = 0;
+    if (access(conf, F_OK) != 0 && errno == ENOENT) {
+      fprintf(stderr, "journal: %s doesn't exist any more, %d clients can't be added\n",
+        records[i].server, n);
+      status = JOURNAL_ABORT;
+    } else if (pool == NULL) {
+      perror("pool: memory allocation error");
+      status = JOURNAL_RETRY;
+    } else if (wg_pool_load_peers(records[i].server, pool, keys, allowed, n) != 0) {
+      status = JOURNAL_RETRY;
+    }
+
+    for (int k = 0; k < n; k++) {
+      if (status != 0) {
+        results[members[k]] = status;
+        continue;
+      }
+
+      results[members[k]] = journal_apply(&records[members[k]], archive, pool, allowed[k]);
+      crash_point("apply");
+
+      // A key queued twice is in the config once its first operation is applied.
+      for (int m = k + 1; m < n && allowed[k][0] != '\0'; m++)
+        if (allowed[m][0] == '\0' && strcmp(keys[m], keys[k]) == 0)
+          memcpy(allowed[m], allowed[k], 64);
+    }
+
+    // One rewrite of the tiers file for all peers of the server, a failure retries them all.
+    int shaped = 0;
+    for (int k = 0; k < n; k++) {
+      if (results[members[k]] != 0) continue;
+      peers[shaped].subnetwork = allowed[k];
+      peers[shaped++].tier = records[members[k]].tier;
+    }
+    if (tc_record_tiers(records[i].server, peers, shaped) != 0) {
+      for (int k = 0; k < n; k++)
+        if (results[members[k]] == 0) results[members[k]] = JOURNAL_RETRY;
+    }
+  }
+
+  free(pool);
+}
+
+/**
+ * Makes the configs of the applied operations durable: the server config of
+ * every server once and the client config of every client in /tmp. The
+ * tiers file is synced when it is written. Only then may the done markers
+ * follow, the next fdatasync of the journal would make them durable first.
+ *
+ * @param struct journal_record operations of the group.
+ * @param int number of operations.
+ * @param struct export_archive of the client configs or NULL for /tmp.
+ * @param int results from journal_apply_group(), operations that couldn't
+ *        be synced become JOURNAL_RETRY.
+ */
+static void journal_sync_group(const journal_record *records, int count,
+                               const export_archive *archive, int *results) {
+  int handled[JOURNAL_GROUP_MAX] = {0};
+  char conf[512];
+
+  for (int i = 0; i < count; i++) {
+    if (results[i] != 0 || handled[i]) continue;
+
+    config_path(records[i].server, conf);
+    int failed = journal_sync_file(conf) != 0;
+
+    for (int j = i; j < count; j++) {
+      if (strcmp(records[j].server, records[i].server) != 0) continue;
+      handled[j] = 1;
+      if (failed && results[j] == 0) results[j] = JOURNAL_RETRY;
+    }
+  }
+
+  for (int i = 0; i < count && archive == NULL; i++) {
+    if (results[i] != 0) continue;
+    snprintf(conf, 512, "%s%s.conf", TMP, records[i].name);
+    if (journal_sync_file(conf) != 0) results[i] = JOURNAL_RETRY;
+  }
+}
+
+/**
+ * @param char journal line without the trailing newline.
+ * @param struct journal_record pointer to which the fields will be written.
+ * @return 'I' for an intent, 'D' for a done or 'A' for an abort marker and 0 for a damaged line.
+ */
+static char journal_parse(char *line, journal_record *rec) {
+  char *fields[12], *save = NULL;
+  int count = 0;
+
+  for (char *f = strtok_r(line, "\t", &save); f != NULL && count < 12;
+       f = strtok_r(NULL, "\t", &save))
+    fields[count++] = f;
+
+  if (count == 2 && (strcmp(fields[0], "D") == 0 || strcmp(fields[0], "A") == 0)) {
+    rec->seq = strtoul(fields[1], NULL, 10);
+    return fields[0][0];
+  }
+
+  // Records written before tiers, split tunnels and profiles existed have fewer fields.
+  if (count < 9 || strcmp(fields[0], "I") != 0) return 0;
+
+  rec->seq = strtoul(fields[1], NULL, 10);
+  snprintf(rec->server, sizeof(rec->server), "%s", fields[2]);
+  snprintf(rec->name, sizeof(rec->name), "%s", fields[3]);
+  snprintf(rec->priv_key_hash, sizeof(rec->priv_key_hash), "%s", fields[4]);
+  snprintf(rec->pub_key_hash, sizeof(rec->pub_key_hash), "%s", fields[5]);
+  snprintf(rec->pub_temp_hash, sizeof(rec->pub_temp_hash), "%s", fields[6]);
+  snprintf(rec->publicip, sizeof(rec->publicip), "%s", fields[7]);
+  snprintf(rec->issue, sizeof(rec->issue), "%s", fields[8]);
+  snprintf(rec->tier, sizeof(rec->tier), "%s", count >= 10 ? fields[9] : "-");
+  snprintf(rec->allowed, sizeof(rec->allowed), "%s", count >= 11 ? fields[10] : "-");
+  rec->keepalive = count >= 12 ? atoi(fields[11]) : KEEPALIVE;
+
+  return 'I';
+}
+
+int journal_open(journal *jn) {
+  #ifdef TEMPDIR
+    const char *dir = TMP_JOURNAL_PATH;
+  #else
+    const char *dir = JOURNAL_PATH;
+  #endif
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    perror("journal folder creation error");
+    return 1;
+  }
+
+  char path[256];
+  journal_path(path);
+
+  // The journal holds private keys until they are applied.
+  jn->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (jn->fd == -1) {
+    perror("journal openning error");
+    return 1;
+  }
+
+  // Only one provisioning run may own the journal at a time.
+  if (flock(jn->fd, LOCK_EX | LOCK_NB) != 0) {
+    perror("journal is locked by another process");
+    close(jn->fd);
+    return 1;
+  }
+
+  jn->archive = NULL;
+  jn->failed = 0;
+  jn->exported = NULL;
+  jn->exported_count = 0;
+  jn->exported_capacity = 0;
+  jn->pending = 0;
+  jn->group_size = JOURNAL_GROUP;
+
+  return 0;
+}
+
+int journal_add_client(journal *jn, wireguard_settings *wgs, const char *server,
+                       const char *publicip, const char *issue, const char *tier,
+                       const char *allowed) {
+  if (strpbrk(wgs->name, "\t\n/") != NULL) {
+    fprintf(stderr, "journal: invalid client name\n");
+    return 1;
+  }
+  if (wgs->priv_key_hash[0] == '\0' || wgs->pub_key_hash[0] == '\0') {
+    fprintf(stderr, "journal: %s has no keys\n", wgs->name);
+    return 1;
+  }
+
+  journal_record *rec = &jn->group[jn->pending];
+
+  // The offset of the record is unique within the journal and survives restarts.
+  off_t offset = lseek(jn->fd, 0, SEEK_END);
+  if (offset == -1) {
+    perror("journal seeking error");
+    return 1;
+  }
+
+  rec->seq = (unsigned long)offset;
+  snprintf(rec->server, sizeof(rec->server), "%s", server);
+  snprintf(rec->name, sizeof(rec->name), "%s", wgs->name);
+  snprintf(rec->priv_key_hash, sizeof(rec->priv_key_hash), "%s", wgs->priv_key_hash);
+  snprintf(rec->pub_key_hash, sizeof(rec->pub_key_hash), "%s", wgs->pub_key_hash);
+  snprintf(rec->pub_temp_hash, sizeof(rec->pub_temp_hash), "%s", wgs->pub_temp_hash);
+  snprintf(rec->publicip, sizeof(rec->publicip), "%s", publicip);
+  snprintf(rec->issue, sizeof(rec->issue), "%s", issue);
+  snprintf(rec->tier, sizeof(rec->tier), "%s", tier != NULL ? tier : "-");
+  snprintf(rec->allowed, sizeof(rec->allowed), "%s", allowed != NULL ? allowed : "-");
+  rec->keepalive = wgs->keepalive;
+
+  char line[512];
+  snprintf(line, 512, "I\t%lu\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%d\n", rec->seq,
+    rec->server, rec->name, rec->priv_key_hash, rec->pub_key_hash, rec->pub_temp_hash,
+    rec->publicip, rec->issue, rec->tier, rec->allowed, rec->keepalive);
+
+  if (journal_write(jn->fd, line) != 0) return 1;
+
+  if (jn->pending++ == 0) clock_gettime(CLOCK_MONOTONIC, &jn->first_pending);
+
+  if (jn->pending >= jn->group_size || elapsed_ms(&jn->first_pending) >= JOURNAL_WINDOW_MS)
+    return journal_commit(jn);
+
+  return 0;
+}
+
+int journal_save_list(const char *list, char *id) {
+  // FNV-1a: the same list always gets the same file.
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (const char *c = list; *c != '\0'; c++) {
+    hash ^= (unsigned char)*c;
+    hash *= 0x100000001b3ULL;
+  }
+  snprintf(id, 24, "%016llx", (unsigned long long)hash);
+
+  char path[256], temp[264];
+  list_path(id, path);
+  if (access(path, F_OK) == 0) return 0;
+
+  snprintf(temp, 264, "%s.new", path);
+
+  int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    perror("file creation error");
+    return 1;
+  }
+
+  // The list has to be on disk before any intent that refers to it.
+  if (journal_write(fd, list) != 0 || journal_write(fd, "\n") != 0 || fsync(fd) != 0) {
+    perror("list writing error");
+    close(fd);
+    unlink(temp);
+    return 1;
+  }
+  close(fd);
+
+  if (rename(temp, path) != 0) {
+    perror("list writing error");
+    unlink(temp);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @param struct journal opened with journal_open().
+ * @param unsigned long seq of an operation whose config went to the archive.
+ * @return 0 if successful and 1 on error.
+ */
+static int remember_exported(journal *jn, unsigned long seq) {
+  if (jn->exported_count == jn->exported_capacity) {
+    size_t capacity = jn->exported_capacity ? jn->exported_capacity * 2 : 64;
+    unsigned long *ptr_new = realloc(jn->exported, capacity * sizeof(unsigned long));
+    if (ptr_new == NULL) {
+      perror("exported: memory allocation error");
+      return 1;
+    }
+    jn->exported = ptr_new;
+    jn->exported_capacity = capacity;
+  }
+
+  jn->exported[jn->exported_count++] = seq;
+
+  return 0;
+}
+
+int journal_commit(journal *jn) {
+  if (jn->pending == 0) return 0;
+
+  /*
+   * Nothing from the group touches the configs before its intents are on disk,
+   * so a crash at any point leaves either nothing or a replayable record.
+   */
+  if (fdatasync(jn->fd) != 0) {
+    perror("journal sync error");
+    return 1;
+  }
+  crash_point("sync");
+
+  int status = 0, results[JOURNAL_GROUP_MAX];
+
+  journal_apply_group(jn->group, jn->pending, jn->archive, results);
+  journal_sync_group(jn->group, jn->pending, jn->archive, results);
+
+  for (int i = 0; i < jn->pending; i++) {
+    if (results[i] == JOURNAL_RETRY) {
+      status = 1;
+      continue;
+    }
+    // A config still in the archive buffer isn't written yet, journal_close() marks it.
+    if (results[i] == 0 && jn->archive != NULL) {
+      if (remember_exported(jn, jn->group[i].seq) != 0) status = 1;
+      continue;
+    }
+    if (journal_mark(jn->fd, results[i] == JOURNAL_ABORT ? 'A' : 'D', jn->group[i].seq) != 0)
+      status = 1;
+  }
+  crash_point("mark");
+
+  jn->pending = 0;
+  if (status != 0) jn->failed = 1;
+
+  return status;
+}
+
+int journal_close(journal *jn) {
+  journal_commit(jn);
+
+  if (jn->archive != NULL && export_close(jn->archive) != 0) {
+    fprintf(stderr, "journal: the archive is incomplete, the next run writes its configs to %s\n", TMP);
+    jn->failed = 1;
+  } else {
+    // Only the operations that really failed stay for the next run.
+    for (size_t i = 0; i < jn->exported_count; i++)
+      if (journal_mark(jn->fd, 'D', jn->exported[i]) != 0) jn->failed = 1;
+    // The journal is kept, a replay of the exported operations would leave their keys in /tmp.
+    if (jn->failed && jn->exported_count > 0 && fdatasync(jn->fd) != 0) perror("journal sync error");
+  }
+  free(jn->exported);
+
+  // Everything left in the journal has been applied and synced, start over.
+  int status = jn->failed;
+  if (status == 0 && ftruncate(jn->fd, 0) != 0) {
+    perror("journal truncation error");
+    status = 1;
+  }
+
+  close(jn->fd);
+
+  return status;
+}
+
+int journal_recover(void) {
+  char path[256];
+  journal_path(path);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return errno == ENOENT ? 0 : 1;
+
+  if (flock(fileno(file), LOCK_EX | LOCK_NB) != 0) {
+    perror("journal is locked by another process");
+    fclose(file);
+    return 1;
+  }
+
+  journal_record *records = NULL, rec;
+  size_t count = 0, capacity = 0, len = 0;
+  char *line = NULL;
+
+  while (getline(&line, &len, file) != -1) {
+    // A line without a newline is a torn write from a crash, it was never committed.
+    char *nl = strchr(line, '\n');
+    if (nl == NULL) break;
+    *nl = '\0';
+
+    char type = journal_parse(line, &rec);
+    if (type == 'I') {
+      if (count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        journal_record *ptr_new = realloc(records, capacity * sizeof(journal_record));
+        if (ptr_new == NULL) {
+          perror("records: memory allocation error");
+          free(records);
+          free(line);
+          fclose(file);
+          return 1;
+        }
+        records = ptr_new;
+      }
+      records[count++] = rec;
+    } else if (type == 'D' || type == 'A') {
+      for (size_t i = 0; i < count; i++) {
+        if (records[i].seq == rec.seq) {
+          memmove(&records[i], &records[i+1], (--count - i) * sizeof(journal_record));
+          break;
+        }
+      }
+    }
+  }
+
+  free(line);
+
+  // The lock on the read stream is held until the replay is finished, the stream can't truncate.
+  int fd = open(path, O_WRONLY | O_APPEND);
+  if (fd == -1) {
+    perror("journal openning error");
+    free(records);
+    fclose(file);
+    return 1;
+  }
+
+  if (count == 0) {
+    free(records);
+    int status = ftruncate(fd, 0) == 0 ? 0 : 1;
+    if (status != 0) perror("journal truncation error");
+    close(fd);
+    fclose(file);
+    return status;
+  }
+
+  printf("replaying ");
+  printf("\033[31m%zu\033[0m", count);
+  printf(" unfinished operations from the journal\n");
+
+  int status = 0, servers_count = 0;
+  char servers[JOURNAL_SERVERS][16];
+
+  for (size_t i = 0; i < count; i++)
+    remember_server(servers, &servers_count, records[i].server);
+
+  #ifdef BASHENABLE
+    for (int i = 0; i < servers_count; i++) wg_stop_server(servers[i]);
+  #endif
+
+  // Replayed in groups like a commit. The archive of the interrupted run is gone, configs go to /tmp.
+  for (size_t i = 0; i < count; i += JOURNAL_GROUP_MAX) {
+    int n = count - i < JOURNAL_GROUP_MAX ? (int)(count - i) : JOURNAL_GROUP_MAX;
+    int results[JOURNAL_GROUP_MAX];
+
+    journal_apply_group(&records[i], n, NULL, results);
+    journal_sync_group(&records[i], n, NULL, results);
+
+    for (int j = 0; j < n; j++) {
+      if (results[j] == JOURNAL_RETRY) status = 1;
+      else if (journal_mark(fd, results[j] == JOURNAL_ABORT ? 'A' : 'D', records[i+j].seq) != 0)
+        status = 1;
+    }
+  }
+
+  #ifdef BASHENABLE
+    for (int i = 0; i < servers_count; i++) {
+      wg_start_server(servers[i]);
+      tc_apply(servers[i]);
+    }
+  #endif
+
+  free(records);
+
+  if (status == 0 && ftruncate(fd, 0) != 0) {
+    perror("journal truncation error");
+    status = 1;
+  }
+
+  close(fd);
+  fclose(file);
+
+  return status;
+}
@@ -0,0 +1,127 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <time.h>
+
+#include "export.h"
+#include "wireguard.h"
+
+#ifndef TMP_JOURNAL_PATH
+  #define TMP_JOURNAL_PATH "/tmp/wirewizard/"
+#endif
+#define JOURNAL_PATH "/var/lib/wirewizard/"
+#define JOURNAL_FILE "journal"
+
+// Operations per fdatasync by default and at most, and the longest time an operation may wait in a group.
+#define JOURNAL_GROUP 32
+#define JOURNAL_GROUP_MAX 256
+#define JOURNAL_WINDOW_MS 200
+#define JOURNAL_SERVERS 10
+
+// Results of applying an operation besides 0.
+#define JOURNAL_RETRY 1
+#define JOURNAL_ABORT 2
+
+typedef struct {
+  unsigned long seq;
+  char server[16];
+  char name[64];
+  char priv_key_hash[64];
+  char pub_key_hash[64];
+  char pub_temp_hash[64];
+  char publicip[64];
+  char issue[8];
+  char tier[16];
+  char allowed[24];
+  int keepalive;
+} journal_record;
+
+typedef struct {
+  int fd;
+  int pending;
+  int group_size;
+  int failed;
+  unsigned long *exported;
+  size_t exported_count;
+  size_t exported_capacity;
+  struct timespec first_pending;
+  export_archive *archive;
+  journal_record group[JOURNAL_GROUP_MAX];
+} journal;
+
+/**
+ * Opens the journal for appending, the folder is created if necessary.
+ * Client configs go to /tmp unless jn->archive is set afterwards, groups
+ * hold JOURNAL_GROUP operations unless jn->group_size is changed (1..JOURNAL_GROUP_MAX).
+ *
+ * @param struct journal to initialize.
+ * @return 0 if successful and 1 on error.
+ */
+int journal_open(journal *jn);
+
+/**
+ * Records the intention to add a client. Nothing is applied to the
+ * configs until the group is committed.
+ *
+ * @param struct journal opened with journal_open().
+ * @param struct wireguard_settings with generated client keys and keepalive.
+ * @param char server name.
+ * @param char public ip from get_ip_address().
+ * @param char yes/no to the question about adding dns.
+ * @param char bandwidth tier or NULL.
+ * @param char id from journal_save_list() or NULL for a full tunnel.
+ * @return 0 if successful and 1 on error.
+ */
+int journal_add_client(journal *jn, wireguard_settings *wgs, const char *server,
+                       const char *publicip, const char *issue, const char *tier,
+                       const char *allowed);
+
+/**
+ * AllowedIPs lists are too long for a journal line, they are stored once
+ * per content in the journal folder and referenced by id.
+ *
+ * @param char AllowedIPs list.
+ * @param char pointer to which the id (24 bytes) will be written.
+ * @return 0 if successful and 1 on error.
+ */
+int journal_save_list(const char *list, char *id);
+
+/**
+ * Makes all pending records durable with a single fdatasync, applies them
+ * and syncs the configs they wrote before marking them done.
+ * With TEMPDIR, WW_CRASH=sync|apply|mark in the environment aborts the
+ * process right after that step, for the crash tests.
+ *
+ * @param struct journal opened with journal_open().
+ * @return 0 if successful and 1 on error.
+ */
+int journal_commit(journal *jn);
+
+/**
+ * Commits the last group and closes jn->archive. Operations in the archive
+ * are marked done once it is complete, an incomplete archive leaves them for
+ * the next run, which writes those client configs to /tmp. The journal is
+ * emptied when nothing is left.
+ *
+ * @param struct journal opened with journal_open().
+ * @return 0 if successful and 1 on error.
+ */
+int journal_close(journal *jn);
+
+/**
+ * Every config a group wrote is synced before the done markers of the group,
+ * the tests replace fsync() here to watch that order.
+ *
+ * @param function called with the descriptor and path of each config, NULL restores fsync().
+ */
+void journal_set_sync(int (*sync)(int fd, const char *path));
+
+/**
+ * Replays the operations that were recorded but not marked as done.
+ * Safe to call on every start: re-application is idempotent.
+ *
+ * @return 0 if successful and 1 on error.
+ */
+int journal_recover(void);
+
+#endif
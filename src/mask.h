@@ -6,4 +6,14 @@
 #define MASK_SERVER 28
 #define MASK_CLIENT 32
 
+// Seconds between keepalive packets of clients created without a profile.
+#define KEEPALIVE 20
+
+#define MASK_SERVER6 64
+#define MASK_CLIENT6 128
+
+// Clients per server: 10.0.x.2-10.0.x.14 and fdxx:xxxx:xxxx:x::2-fdxx:xxxx:xxxx:x::ffff.
+#define CLIENTS_SERVER 14
+#define CLIENTS_SERVER6 65535
+
 #endif
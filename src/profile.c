@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "mask.h"
+#include "exec.h"
+#include "profile.h"
+
+/*
+ * Measured against clients sending the default KEEPALIVE: a NAT that rebinds
+ * them dropped its mapping within that time, mobile has to send more often.
+ * A mapping that held over the whole measurement belongs to a home router,
+ * those keep them for minutes.
+ */
+static const client_profile profiles[] = {
+  {"mobile", KEEPALIVE * 3 / 4},
+  {"desktop", KEEPALIVE * 2},
+  {"static", 0},
+};
+
+const client_profile *profile_find(const char *name) {
+  for (size_t i = 0; i < sizeof(profiles) / sizeof(profiles[0]); i++)
+    if (strcmp(profiles[i].name, name) == 0) return &profiles[i];
+
+  return NULL;
+}
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static int compare_peers(const void *a, const void *b) {
+  return strcmp(((const profile_peer*)a)->pub_key, ((const profile_peer*)b)->pub_key);
+}
+
+/**
+ * @param char endpoint "address:port" or "[address]:port".
+ * @return length of the address part.
+ */
+static size_t endpoint_host(const char *endpoint) {
+  const char *colon = strrchr(endpoint, ':');
+
+  return colon != NULL ? (size_t)(colon - endpoint) : strlen(endpoint);
+}
+
+/**
+ * Compares one peer line of wg show dump with the previous samples.
+ *
+ * @param struct profile_measurement, new peers are appended.
+ * @param size_t number of peers at the start that are sorted by public key.
+ * @param char peer line without the trailing newline.
+ * @return 0 if successful and 1 on error.
+ */
+static int update_peer(profile_measurement *m, size_t sorted, char *line) {
+  char *fields[8], *save = NULL;
+  int n = 0;
+
+  for (char *f = strtok_r(line, "\t", &save); f != NULL && n < 8; f = strtok_r(NULL, "\t", &save))
+    fields[n++] = f;
+  if (n != 8) return 0;
+
+  profile_peer key;
+  snprintf(key.pub_key, 64, "%s", fields[0]);
+
+  long handshake = strtol(fields[4], NULL, 10);
+
+  // A dump lists every peer once, a peer appended in this sample isn't looked for again.
+  profile_peer *peer = bsearch(&key, m->peers, sorted, sizeof(profile_peer), compare_peers);
+  if (peer == NULL) {
+    if (m->count == m->capacity) {
+      size_t capacity = m->capacity ? m->capacity * 2 : 256;
+      profile_peer *ptr_new = realloc(m->peers, capacity * sizeof(profile_peer));
+      if (ptr_new == NULL) {
+        perror("peers: memory allocation error");
+        return 1;
+      }
+      m->peers = ptr_new;
+      m->capacity = capacity;
+    }
+
+    peer = &m->peers[m->count++];
+    memset(peer, 0, sizeof(profile_peer));
+    snprintf(peer->pub_key, 64, "%s", fields[0]);
+    snprintf(peer->allowed, 64, "%.*s", (int)strcspn(fields[3], ","), fields[3]);
+    snprintf(peer->endpoint, 64, "%s", fields[2]);
+    peer->handshake = handshake;
+    return 0;
+  }
+
+  if (strcmp(peer->endpoint, fields[2]) != 0 && strcmp(peer->endpoint, "(none)") != 0) {
+    size_t len = endpoint_host(fields[2]);
+    if (len == endpoint_host(peer->endpoint) && strncmp(peer->endpoint, fields[2], len) == 0)
+      peer->rebinds++;
+    else
+      peer->roams++;
+  }
+  snprintf(peer->endpoint, 64, "%s", fields[2]);
+
+  if (handshake != peer->handshake) peer->handshakes++;
+  peer->handshake = handshake;
+
+  return 0;
+}
+
+int profile_sample(profile_measurement *measurement, char *dump) {
+  size_t sorted = measurement->count;
+
+  // The first line describes the interface itself.
+  char *save = NULL, *line = strtok_r(dump, "\n", &save);
+  for (line = strtok_r(NULL, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    if (update_peer(measurement, sorted, line) != 0) return 1;
+
+  // New peers are rare after the first sample, they are sorted in once per sample.
+  if (measurement->count != sorted)
+    qsort(measurement->peers, measurement->count, sizeof(profile_peer), compare_peers);
+  measurement->samples++;
+
+  return 0;
+}
+
+const client_profile *profile_recommend(const profile_peer *peer, int seconds) {
+  if (peer->handshake == 0 || strcmp(peer->endpoint, "(none)") == 0) return NULL;
+  // Long enough for a renewal, but none came: nothing was sent and nothing can be told.
+  if (seconds >= PROFILE_IDLE_S && peer->handshakes == 0) return NULL;
+  // A roaming client or a NAT mapping that expired between packets needs a shorter interval.
+  if (peer->roams > 0 || peer->rebinds > 0) return &profiles[0];
+
+  return &profiles[1];
+}
+
+void profile_free(profile_measurement *measurement) {
+  free(measurement->peers);
+  memset(measurement, 0, sizeof(profile_measurement));
+}
+
+int profile_measure(const char *server, int seconds) {
+  char *dump[] = {"wg", "show", (char*)server, "dump", NULL};
+  profile_measurement m = {NULL, 0, 0, 0};
+  int measured = 0;
+
+  struct sigaction action = {0};
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  printf("measuring ");
+  printf("\033[32m%s\033[0m", server);
+  printf(" for %d seconds, ctrl+c to stop earlier\n", seconds);
+  fflush(stdout);
+
+  for (int elapsed = 0; !stop && elapsed <= seconds; elapsed += PROFILE_SAMPLE_S) {
+    char *output = NULL;
+    size_t size = 0;
+
+    if (exec_capture(dump, NULL, 0, &output, &size) != 0) {
+      fprintf(stderr, "couldn't read the peers of %s\n", server);
+      free(output);
+      profile_free(&m);
+      return 1;
+    }
+
+    int status = profile_sample(&m, output);
+    free(output);
+    if (status != 0) {
+      profile_free(&m);
+      return 1;
+    }
+    measured = elapsed;
+
+    if (elapsed < seconds) sleep(PROFILE_SAMPLE_S);
+  }
+
+  double now = 0, after = 0;
+
+  for (size_t i = 0; i < m.count; i++) {
+    const profile_peer *peer = &m.peers[i];
+    // After ctrl+c only the time up to the last sample counts.
+    const client_profile *profile = profile_recommend(peer, measured);
+
+    printf("%-20s roams %d, rebinds %d, handshakes %d",
+      peer->allowed, peer->roams, peer->rebinds, peer->handshakes);
+
+    if (profile != NULL) {
+      // Compared with every connected client sending the default keepalive.
+      now += 1.0 / KEEPALIVE;
+      if (profile->keepalive > 0) after += 1.0 / profile->keepalive;
+
+      printf(" -> ");
+      printf("\033[32m%s\033[0m", profile->name);
+      printf(" (%ds)", profile->keepalive);
+    }
+    printf("\n");
+  }
+
+  printf("%d samples, keepalive packets per second: ", m.samples);
+  printf("\033[31m%.2f\033[0m", now);
+  printf(" with the default %ds, ", KEEPALIVE);
+  printf("\033[32m%.2f\033[0m", after);
+  printf(" with the recommended profiles\n");
+
+  profile_free(&m);
+
+  return 0;
+}
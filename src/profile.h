@@ -0,0 +1,78 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+
+// wg show dump is read every PROFILE_SAMPLE_S seconds during a measurement.
+#define PROFILE_SAMPLE_S 5
+#define PROFILE_WINDOW_S 300
+// A session is renewed at least this often while packets flow, without a handshake that long a peer was idle.
+#define PROFILE_IDLE_S 180
+
+typedef struct {
+  const char *name;
+  int keepalive;
+} client_profile;
+
+typedef struct {
+  char pub_key[64];
+  char allowed[64];
+  char endpoint[64];
+  long handshake;
+  int handshakes;
+  int roams;
+  int rebinds;
+} profile_peer;
+
+typedef struct {
+  profile_peer *peers;
+  size_t count;
+  size_t capacity;
+  int samples;
+} profile_measurement;
+
+/**
+ * @param char profile name.
+ * @return the profile or NULL if there is no such profile.
+ */
+const client_profile *profile_find(const char *name);
+
+/**
+ * Compares one wg show dump with the previous samples: a new endpoint
+ * address is a roam, a new port of the same address a rebind.
+ *
+ * @param struct profile_measurement zeroed before the first sample, profile_free() it.
+ * @param char output of wg show dump, it is cut into lines.
+ * @return 0 if successful and 1 on error.
+ */
+int profile_sample(profile_measurement *measurement, char *dump);
+
+/**
+ * The keepalive of the client is not visible on the server, only its effects,
+ * the clients are assumed to send the default KEEPALIVE.
+ *
+ * @param struct profile_peer measured peer.
+ * @param int length of the measurement in seconds.
+ * @return recommended profile or NULL if the peer wasn't connected.
+ */
+const client_profile *profile_recommend(const profile_peer *peer, int seconds);
+
+/**
+ * @param struct profile_measurement to free.
+ */
+void profile_free(profile_measurement *measurement);
+
+/**
+ * Samples the peer stats of a running server and recommends a profile
+ * for every connected peer: endpoints that change address (roaming) or
+ * only port (lost NAT mapping) get mobile, stable ones get desktop.
+ * static is left to the admin, the server can't tell a NAT from none.
+ * Stops early on SIGINT or SIGTERM.
+ *
+ * @param char wg interface name.
+ * @param int length of the measurement in seconds.
+ * @return 0 if successful and 1 on error.
+ */
+int profile_measure(const char *server, int seconds);
+
+#endif
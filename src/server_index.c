@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "wireguard.h"
+#include "server_index.h"
+
+/**
+ * @return the folder of the server configs.
+ */
+static const char *config_dir(void) {
+  #ifdef TEMPDIR
+    return TMP_WG_PATH;
+  #else
+    return WG_PATH;
+  #endif
+}
+
+/**
+ * @param char pointer to which the index path will be written.
+ */
+static void index_path(char *path) {
+  #ifdef TEMPDIR
+    snprintf(path, 256, "%s%s", TMP_SERVER_INDEX_PATH, SERVER_INDEX_FILE);
+  #else
+    snprintf(path, 256, "%s%s", SERVER_INDEX_PATH, SERVER_INDEX_FILE);
+  #endif
+}
+
+/**
+ * @param struct timespec time from stat().
+ * @param long seconds from the index.
+ * @param long nanoseconds from the index.
+ * @return 1 if both are the same time and 0 if not.
+ */
+static int same_time(const struct timespec *time, long sec, long nsec) {
+  return time->tv_sec == sec && time->tv_nsec == nsec;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  return strcmp(((const server_index_entry*)a)->name, ((const server_index_entry*)b)->name);
+}
+
+/**
+ * @param struct server_index to grow.
+ * @param size_t pointer to the capacity of the entries.
+ * @return the new entry or NULL on error.
+ */
+static server_index_entry *append_entry(server_index *idx, size_t *capacity) {
+  if (idx->count == *capacity) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    server_index_entry *ptr_new = realloc(idx->entries, *capacity * sizeof(server_index_entry));
+    if (ptr_new == NULL) {
+      perror("servers: memory allocation error");
+      return NULL;
+    }
+    idx->entries = ptr_new;
+  }
+
+  return &idx->entries[idx->count++];
+}
+
+int server_index_scan(const char *name, server_index_entry *entry) {
+  char conf[512];
+  snprintf(conf, 512, "%s%s.conf", config_dir(), name);
+
+  // Taken before the config is read: a write in between leaves a stat that won't match.
+  struct stat st;
+  if (stat(conf, &st) != 0) {
+    perror("file reading error");
+    return 1;
+  }
+
+  wg_address_pool *pool = malloc(sizeof(wg_address_pool));
+  if (pool == NULL) {
+    perror("pool: memory allocation error");
+    return 1;
+  }
+  if (wg_pool_load(name, pool) != 0) {
+    free(pool);
+    return 1;
+  }
+
+  snprintf(entry->name, 64, "%s", name);
+  entry->capacity = wg_pool_capacity(pool);
+  entry->peers = entry->capacity - wg_pool_free(pool);
+  entry->ino = st.st_ino;
+  entry->size = st.st_size;
+  entry->mtime = st.st_mtim;
+
+  free(pool);
+
+  return 0;
+}
+
+int server_index_write(server_index *idx) {
+  #ifdef TEMPDIR
+    const char *dir = TMP_SERVER_INDEX_PATH;
+  #else
+    const char *dir = SERVER_INDEX_PATH;
+  #endif
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    perror("index folder creation error");
+    return 1;
+  }
+
+  char path[256], temp[264];
+  index_path(path);
+  snprintf(temp, 264, "%s.new", path);
+
+  FILE *out = fopen(temp, "w");
+  if (out == NULL) {
+    perror("file creation error");
+    return 1;
+  }
+
+  qsort(idx->entries, idx->count, sizeof(server_index_entry), compare_entries);
+
+  fprintf(out, "dir\t%ld\t%ld\n", (long)idx->dir_mtime.tv_sec, idx->dir_mtime.tv_nsec);
+  for (size_t i = 0; i < idx->count; i++) {
+    const server_index_entry *e = &idx->entries[i];
+    fprintf(out, "%s\t%d\t%d\t%lu\t%lld\t%ld\t%ld\n", e->name, e->peers, e->capacity,
+      (unsigned long)e->ino, (long long)e->size, (long)e->mtime.tv_sec, e->mtime.tv_nsec);
+  }
+
+  // Readers never see half an index.
+  if (ferror(out) != 0 || fclose(out) != 0 || rename(temp, path) != 0) {
+    perror("index writing error");
+    unlink(temp);
+    return 1;
+  }
+
+  return 0;
+}
+
+/**
+ * @param struct server_index to fill.
+ * @return 0 if the index matches the configs and 1 if it is missing or stale.
+ */
+static int server_index_load(server_index *idx) {
+  char path[256];
+  index_path(path);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return 1;
+
+  struct stat st;
+  long sec, nsec;
+  char buffer[512];
+  size_t capacity = 0;
+  int status = 1;
+
+  // Any server created, renamed or removed changes the folder itself.
+  if (fgets(buffer, 512, file) != NULL && sscanf(buffer, "dir\t%ld\t%ld", &sec, &nsec) == 2 &&
+      stat(config_dir(), &st) == 0 && same_time(&st.st_mtim, sec, nsec)) {
+    idx->dir_mtime = st.st_mtim;
+    status = 0;
+
+    while (status == 0 && fgets(buffer, 512, file) != NULL) {
+      server_index_entry entry;
+      unsigned long ino;
+      long long size;
+      char conf[512];
+
+      if (sscanf(buffer, "%63[^\t]\t%d\t%d\t%lu\t%lld\t%ld\t%ld", entry.name, &entry.peers,
+                 &entry.capacity, &ino, &size, &sec, &nsec) != 7) {
+        status = 1;
+        break;
+      }
+
+      // A config rewritten since the index was saved is caught by its inode, size or time.
+      snprintf(conf, 512, "%s%s.conf", config_dir(), entry.name);
+      if (stat(conf, &st) != 0 || st.st_ino != (ino_t)ino || st.st_size != (off_t)size ||
+          !same_time(&st.st_mtim, sec, nsec)) {
+        status = 1;
+        break;
+      }
+      entry.ino = st.st_ino;
+      entry.size = st.st_size;
+      entry.mtime = st.st_mtim;
+
+      server_index_entry *slot = append_entry(idx, &capacity);
+      if (slot == NULL) status = 1;
+      else *slot = entry;
+    }
+  }
+
+  fclose(file);
+
+  if (status != 0) server_index_free(idx);
+
+  return status;
+}
+
+/**
+ * Full pass over the config folder, the result is saved for the next run.
+ *
+ * @param struct server_index to fill.
+ * @return 0 if successful and 1 on error.
+ */
+static int server_index_build(server_index *idx) {
+  struct stat st;
+  if (stat(config_dir(), &st) != 0) {
+    perror("error when trying to find a folder");
+    return 1;
+  }
+  idx->dir_mtime = st.st_mtim;
+
+  DIR *dir = opendir(config_dir());
+  if (dir == NULL) {
+    perror("error when trying to find a folder");
+    return 1;
+  }
+
+  struct dirent *entry;
+  size_t capacity = 0;
+
+  while ((entry = readdir(dir)) != NULL) {
+    size_t len = strlen(entry->d_name);
+    if (len <= 5 || len - 5 >= 64 || strcmp(entry->d_name + len - 5, ".conf") != 0) continue;
+
+    char name[64];
+    snprintf(name, 64, "%.*s", (int)(len - 5), entry->d_name);
+
+    server_index_entry *slot = append_entry(idx, &capacity);
+    if (slot == NULL || server_index_scan(name, slot) != 0) {
+      closedir(dir);
+      server_index_free(idx);
+      return 1;
+    }
+  }
+
+  closedir(dir);
+
+  // Without a writable state folder every run scans, nothing else is lost.
+  server_index_write(idx);
+
+  return 0;
+}
+
+int server_index_get(server_index *idx) {
+  idx->entries = NULL;
+  idx->count = 0;
+
+  if (server_index_load(idx) == 0) return 0;
+
+  return server_index_build(idx);
+}
+
+void server_index_free(server_index *idx) {
+  free(idx->entries);
+  idx->entries = NULL;
+  idx->count = 0;
+}
@@ -0,0 +1,63 @@
+#ifndef SERVER_INDEX_H
+#define SERVER_INDEX_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#ifndef TMP_SERVER_INDEX_PATH
+  #define TMP_SERVER_INDEX_PATH "/tmp/wirewizard/"
+#endif
+#define SERVER_INDEX_PATH "/var/lib/wirewizard/"
+#define SERVER_INDEX_FILE "servers"
+
+typedef struct {
+  char name[64];
+  int peers;
+  int capacity;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+} server_index_entry;
+
+typedef struct {
+  struct timespec dir_mtime;
+  server_index_entry *entries;
+  size_t count;
+} server_index;
+
+/**
+ * Reads one server config and remembers which version of the file it saw.
+ *
+ * @param char server name.
+ * @param struct server_index_entry pointer to which the summary will be written.
+ * @return 0 if successful and 1 on error.
+ */
+int server_index_scan(const char *name, server_index_entry *entry);
+
+/**
+ * Sorts the entries by name and replaces the index file. dir_mtime has to
+ * be taken before the configs were scanned, a config created in between
+ * then makes the index stale.
+ *
+ * @param struct server_index to save.
+ * @return 0 if successful and 1 on error.
+ */
+int server_index_write(server_index *idx);
+
+/**
+ * Uses the index written by ww --watch or by an earlier run while the
+ * config folder and every config in it are unchanged, otherwise scans all
+ * configs and rewrites the index. Entries are sorted by name.
+ *
+ * @param struct server_index to fill, free it with server_index_free().
+ * @return 0 if successful and 1 on error.
+ */
+int server_index_get(server_index *idx);
+
+/**
+ * @param struct server_index filled by server_index_get().
+ */
+void server_index_free(server_index *idx);
+
+#endif
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "exec.h"
+#include "tc.h"
+
+// Rates are per peer and in the direction server -> client.
+static const tc_tier tiers[] = {
+  {"bronze", "10mbit"},
+  {"silver", "50mbit"},
+  {"gold", "200mbit"},
+};
+
+const tc_tier *tc_find_tier(const char *name) {
+  for (size_t i = 0; i < sizeof(tiers) / sizeof(tiers[0]); i++)
+    if (strcmp(tiers[i].name, name) == 0) return &tiers[i];
+
+  return NULL;
+}
+
+/**
+ * @param char wg interface name.
+ * @param char pointer to which the tiers path will be written.
+ */
+static void tiers_path(const char *server, char *path) {
+  #ifdef TEMPDIR
+    snprintf(path, 512, "%s%s.tiers", TMP_TIERS_PATH, server);
+  #else
+    snprintf(path, 512, "%s%s.tiers", TIERS_PATH, server);
+  #endif
+}
+
+/**
+ * @param char tiers line: address tier [address6].
+ * @param char first address of the peer.
+ * @param char IPv6 address of a dual-stack peer or "".
+ * @return 1 if the line belongs to one of the addresses and 0 if not.
+ */
+static int same_peer(const char *line, const char *address, const char *address6) {
+  char current[64], name[64], current6[64];
+  int fields = sscanf(line, "%63s %63s %63s", current, name, current6);
+
+  if (fields >= 1 && strcmp(current, address) == 0) return 1;
+  if (address6[0] == '\0') return 0;
+
+  return (fields >= 1 && strcmp(current, address6) == 0) ||
+         (fields == 3 && strcmp(current6, address6) == 0);
+}
+
+/**
+ * @param char peer address from wg_init_settings_client().
+ * @param char pointer to which the first address will be written.
+ * @param char pointer to which the IPv6 address of a dual-stack peer or "" will be written.
+ */
+static void split_addresses(const char *subnetwork, char *address, char *address6) {
+  // The first address of the peer is the key, a dual-stack peer keeps its IPv6 one after the tier.
+  size_t len = strcspn(subnetwork, ", ");
+  snprintf(address, 64, "%.*s", (int)len, subnetwork);
+  address6[0] = '\0';
+  if (subnetwork[len] != '\0')
+    sscanf(subnetwork + len + strspn(subnetwork + len, ", "), "%63[^, ]", address6);
+}
+
+/**
+ * A renamed file is only durable once its folder is.
+ *
+ * @param char folder path.
+ * @return 0 if successful and 1 on error.
+ */
+static int sync_dir(const char *dir) {
+  int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd == -1) return 1;
+
+  int status = fsync(fd) == 0 ? 0 : 1;
+  close(fd);
+
+  return status;
+}
+
+/**
+ * @param char wg interface name.
+ * @param struct tc_peer peers of the group.
+ * @param char first and IPv6 address of every peer.
+ * @param int pointer to which 1 is written for every peer whose old entry was dropped.
+ * @param size_t number of peers.
+ * @return 1 if the file was replaced, 0 if nothing had to change and -1 on error.
+ */
+static int write_tiers(const char *server, const tc_peer *peers, char (*addresses)[2][64],
+                       int *removed, size_t count) {
+  #ifdef TEMPDIR
+    const char *dir = TMP_TIERS_PATH;
+  #else
+    const char *dir = TIERS_PATH;
+  #endif
+  char path[512], temp[520];
+  tiers_path(server, path);
+  snprintf(temp, 520, "%s.new", path);
+
+  int changed = 0;
+  for (size_t i = 0; i < count; i++)
+    if (peers[i].tier != NULL && strcmp(peers[i].tier, "-") != 0) changed = 1;
+
+  FILE *in = fopen(path, "r");
+  if (in == NULL && errno != ENOENT) {
+    perror("file reading error");
+    return -1;
+  }
+  // Nothing was ever shaped on this server, there is nothing to clear.
+  if (in == NULL && !changed) return 0;
+
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    perror("tiers folder creation error");
+    if (in != NULL) fclose(in);
+    return -1;
+  }
+
+  FILE *out = fopen(temp, "w");
+  if (out == NULL) {
+    perror("file creation error");
+    if (in != NULL) fclose(in);
+    return -1;
+  }
+
+  // Addresses are reused, an entry of a removed peer must not shape the new one.
+  if (in != NULL) {
+    char buffer[256];
+    while (fgets(buffer, 256, in) != NULL) {
+      int drop = 0;
+      for (size_t i = 0; i < count; i++) {
+        if (same_peer(buffer, addresses[i][0], addresses[i][1])) {
+          removed[i] = 1;
+          drop = 1;
+        }
+      }
+      if (drop) changed = 1;
+      else fputs(buffer, out);
+    }
+    fclose(in);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (peers[i].tier == NULL || strcmp(peers[i].tier, "-") == 0) continue;
+    // The same peer twice in a group keeps its last tier.
+    int later = 0;
+    for (size_t j = i + 1; j < count && !later; j++) later = strcmp(addresses[j][0], addresses[i][0]) == 0;
+    if (later) continue;
+    fprintf(out, "%s %s%s%s\n", addresses[i][0], peers[i].tier,
+      addresses[i][1][0] ? " " : "", addresses[i][1]);
+  }
+
+  if (!changed) {
+    fclose(out);
+    unlink(temp);
+    return 0;
+  }
+
+  // Synced next to the old file and renamed over it, a crash never leaves half a list.
+  int written = fflush(out) == 0 && fsync(fileno(out)) == 0;
+  if (fclose(out) != 0 || !written || rename(temp, path) != 0 || sync_dir(dir) != 0) {
+    perror("tiers writing error");
+    unlink(temp);
+    return -1;
+  }
+
+  return 1;
+}
+
+int tc_record_tiers(const char *server, const tc_peer *peers, size_t count) {
+  if (count == 0) return 0;
+
+  char (*addresses)[2][64] = malloc(count * sizeof(*addresses));
+  int *removed = calloc(count, sizeof(int));
+  if (addresses == NULL || removed == NULL) {
+    perror("tiers: memory allocation error");
+    free(addresses);
+    free(removed);
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    split_addresses(peers[i].subnetwork, addresses[i][0], addresses[i][1]);
+
+  int status = write_tiers(server, peers, addresses, removed, count);
+
+  for (size_t i = 0; status == 1 && i < count; i++) {
+    int clear = peers[i].tier == NULL || strcmp(peers[i].tier, "-") == 0;
+    if (clear && !removed[i]) continue;
+
+    printf("\033[32m%s\033[0m", addresses[i][0]);
+    if (clear) {
+      printf(" is no longer shaped\n");
+    } else {
+      printf(" is in the ");
+      printf("\033[32m%s\033[0m", peers[i].tier);
+      printf(" tier\n");
+    }
+  }
+
+  free(addresses);
+  free(removed);
+
+  return status == -1 ? 1 : 0;
+}
+
+int tc_record_tier(const char *server, const char *subnetwork, const char *tier) {
+  tc_peer peer = {subnetwork, tier};
+
+  return tc_record_tiers(server, &peer, 1);
+}
+
+/**
+ * @param char format of the tc arguments separated by spaces.
+ * @return 0 if tc succeeded and 1 otherwise.
+ */
+static int tc(const char *format, ...) {
+  char command[256], *argv[32];
+  int argc = 0;
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf(command, 256, format, args);
+  va_end(args);
+
+  argv[argc++] = "tc";
+  for (char *save = NULL, *arg = strtok_r(command, " ", &save); arg != NULL && argc < 31;
+       arg = strtok_r(NULL, " ", &save))
+    argv[argc++] = arg;
+  argv[argc] = NULL;
+
+  return exec_run(argv, 1);
+}
+
+/**
+ * Commands for a single tc -batch run, one per line.
+ */
+typedef struct {
+  char *text;
+  size_t len;
+  size_t capacity;
+  int failed;
+} tc_batch;
+
+/**
+ * @param struct tc_batch to append to.
+ * @param char format of the tc arguments separated by spaces.
+ */
+static void batch_add(tc_batch *batch, const char *format, ...) {
+  char command[256];
+
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(command, 256, format, args);
+  va_end(args);
+
+  if (len < 0 || len >= 255) {
+    batch->failed = 1;
+    return;
+  }
+
+  if (batch->len + len + 1 > batch->capacity) {
+    size_t capacity = batch->capacity ? batch->capacity * 2 : 4096;
+    char *ptr_new = realloc(batch->text, capacity);
+    if (ptr_new == NULL) {
+      perror("tc batch: memory allocation error");
+      batch->failed = 1;
+      return;
+    }
+    batch->text = ptr_new;
+    batch->capacity = capacity;
+  }
+
+  memcpy(batch->text + batch->len, command, len);
+  batch->len += len;
+  batch->text[batch->len++] = '\n';
+}
+
+/**
+ * @param struct tc_batch to append to.
+ * @param char wg interface name.
+ * @param char peer address, IPv4 or IPv6.
+ * @param int class of the peer.
+ */
+static void batch_filter(tc_batch *batch, const char *server, const char *address, int classid) {
+  if (strchr(address, ':') != NULL)
+    batch_add(batch, "filter add dev %s parent 1: protocol ipv6 prio 2 u32 match ip6 dst %s flowid 1:%x",
+              server, address, classid);
+  else
+    batch_add(batch, "filter add dev %s parent 1: protocol ip prio 1 u32 match ip dst %s flowid 1:%x",
+              server, address, classid);
+}
+
+int tc_apply(const char *server) {
+  char path[512];
+  tiers_path(server, path);
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return errno == ENOENT ? 0 : 1;
+
+  // Starting from an empty root makes the whole tree idempotent. It fails when there is no root yet.
+  tc("qdisc del dev %s root", server);
+
+  // Everything else is one tc process, not four per peer.
+  tc_batch batch = {NULL, 0, 0, 0};
+  batch_add(&batch, "qdisc add dev %s root handle 1: htb default 1", server);
+  batch_add(&batch, "class add dev %s parent 1: classid 1:1 htb rate 10gbit", server);
+
+  char buffer[256], address[64], name[64], address6[64];
+  int classid = 0x10;
+
+  while (fgets(buffer, 256, file) != NULL) {
+    int fields = sscanf(buffer, "%63s %63s %63s", address, name, address6);
+    if (fields < 2) continue;
+
+    const tc_tier *tier = tc_find_tier(name);
+    if (tier == NULL) {
+      fprintf(stderr, "tc: unknown tier %s for %s\n", name, address);
+      continue;
+    }
+
+    batch_add(&batch, "class add dev %s parent 1: classid 1:%x htb rate %s ceil %s",
+              server, classid, tier->rate, tier->rate);
+    batch_add(&batch, "qdisc add dev %s parent 1:%x fq_codel", server, classid);
+    batch_filter(&batch, server, address, classid);
+    if (fields == 3) batch_filter(&batch, server, address6, classid);
+
+    classid++;
+  }
+
+  fclose(file);
+
+  char *tc_batch_argv[] = {"tc", "-batch", "-", NULL};
+  char *output = NULL;
+  size_t output_size = 0;
+  int status = batch.failed;
+  if (status != 0) fprintf(stderr, "tc: couldn't prepare the commands for %s\n", server);
+
+  if (status == 0 && exec_capture(tc_batch_argv, batch.text, batch.len, &output, &output_size) != 0) {
+    fprintf(stderr, "tc: couldn't shape the peers of %s\n", server);
+    status = 1;
+  }
+
+  free(output);
+  free(batch.text);
+
+  if (status == 0) {
+    printf("traffic shaping for ");
+    printf("\033[32m%s\033[0m", server);
+    printf(" is applied\n");
+  }
+
+  return status;
+}
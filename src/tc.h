@@ -0,0 +1,61 @@
+#ifndef TC_H
+#define TC_H
+
+#include <stddef.h>
+
+#ifndef TMP_TIERS_PATH
+  #define TMP_TIERS_PATH "/tmp/wirewizard/"
+#endif
+#define TIERS_PATH "/var/lib/wirewizard/"
+
+typedef struct {
+  const char *name;
+  const char *rate;
+} tc_tier;
+
+/**
+ * @param char tier name.
+ * @return the tier or NULL if there is no such tier.
+ */
+const tc_tier *tc_find_tier(const char *name);
+
+typedef struct {
+  const char *subnetwork;
+  const char *tier;
+} tc_peer;
+
+/**
+ * Remembers the tiers of a group of peers in <server>.tiers with a single
+ * rewrite of the file, existing entries for the same addresses are replaced.
+ * Called for every new peer, so a peer without a tier never inherits the
+ * entry of a reused address. The new file is synced before it replaces the old one.
+ *
+ * @param char wg interface name.
+ * @param struct tc_peer addresses from wg_init_settings_client() and tier names,
+ *        NULL or "-" to remove the entry.
+ * @param size_t number of peers.
+ * @return 0 if successful and 1 on error.
+ */
+int tc_record_tiers(const char *server, const tc_peer *peers, size_t count);
+
+/**
+ * tc_record_tiers() for a single peer.
+ *
+ * @param char wg interface name.
+ * @param char peer address from wg_init_settings_client().
+ * @param char tier name, NULL or "-" to remove the entry.
+ * @return 0 if successful and 1 on error.
+ */
+int tc_record_tier(const char *server, const char *subnetwork, const char *tier);
+
+/**
+ * Replaces the root qdisc of the interface with an HTB tree: one class
+ * with fq_codel per tiered peer, selected by the peer address, and an
+ * unshaped default class for everyone else.
+ *
+ * @param char wg interface name.
+ * @return 0 if successful and 1 on error.
+ */
+int tc_apply(const char *server);
+
+#endif
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+
+#include "exec.h"
+#include "mask.h"
+#include "topology.h"
+
+/**
+ * @param char key from the inventory.
+ * @return 1 if the key looks like a wireguard base64 key and 0 if not.
+ */
+static int valid_key(const char *key) {
+  if (strlen(key) != 44 || key[43] != '=') return 0;
+
+  for (int i = 0; i < 43; i++)
+    if (!(isalnum((unsigned char)key[i]) || key[i] == '+' || key[i] == '/'))
+      return 0;
+
+  return 1;
+}
+
+/**
+ * Replaces the host part with zeros: 10.10.3.7/16 -> 10.10.0.0/16.
+ *
+ * @param char address with prefix.
+ * @param char pointer to which the network will be written.
+ * @return 0 if successful and 1 on error.
+ */
+static int network_of(const char *address, char *network) {
+  char host[64];
+  int prefix = 32;
+
+  snprintf(host, 64, "%s", address);
+  char *slash = strchr(host, '/');
+  if (slash != NULL) {
+    *slash = '\0';
+    prefix = atoi(slash + 1);
+  }
+
+  struct in_addr addr;
+  if (inet_pton(AF_INET, host, &addr) != 1 || prefix < 0 || prefix > 32) return 1;
+
+  uint32_t mask = prefix == 0 ? 0 : htonl(0xffffffffu << (32 - prefix));
+  addr.s_addr &= mask;
+
+  char buffer[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr, buffer, INET_ADDRSTRLEN);
+  snprintf(network, 64, "%s/%d", buffer, prefix);
+
+  return 0;
+}
+
+/**
+ * @param char address with or without prefix.
+ * @param char pointer to which the address with /32 will be written.
+ */
+static void host_of(const char *address, char *host) {
+  snprintf(host, 64, "%.*s/32", (int)strcspn(address, "/"), address);
+}
+
+/**
+ * @param char endpoint host:port from the inventory.
+ * @return the port or NULL if the endpoint has no host or no valid port.
+ */
+static const char *endpoint_port(const char *endpoint) {
+  const char *port = strrchr(endpoint, ':');
+  if (port == NULL || port == endpoint || port[1] == '\0') return NULL;
+
+  for (const char *c = port + 1; *c != '\0'; c++)
+    if (!isdigit((unsigned char)*c)) return NULL;
+
+  long number = strtol(port + 1, NULL, 10);
+
+  return number >= 1 && number <= 65535 ? port + 1 : NULL;
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(const char *const*)a, *(const char *const*)b);
+}
+
+/**
+ * Every node is a config file, two nodes with one name would be written
+ * by two workers at once.
+ *
+ * @param struct topology_node array of nodes.
+ * @param size_t number of nodes.
+ * @return 0 if all names are unique and 1 otherwise.
+ */
+static int check_unique_names(const topology_node *nodes, size_t count) {
+  const char **names = malloc(count * sizeof(char*));
+  if (names == NULL) {
+    perror("names: memory allocation error");
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++) names[i] = nodes[i].name;
+  qsort(names, count, sizeof(char*), compare_names);
+
+  int status = 0;
+  for (size_t i = 1; i < count; i++) {
+    if (strcmp(names[i-1], names[i]) == 0) {
+      fprintf(stderr, "inventory: node %s is listed more than once\n", names[i]);
+      status = 1;
+      break;
+    }
+  }
+
+  free(names);
+
+  return status;
+}
+
+typedef struct {
+  uint32_t addr;
+  const char *name;
+} node_address;
+
+static int compare_addresses(const void *a, const void *b) {
+  uint32_t x = ((const node_address*)a)->addr, y = ((const node_address*)b)->addr;
+
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * Every node is the /32 of its address in the AllowedIPs of the others,
+ * wg gives a /32 listed twice to the last peer only.
+ *
+ * @param struct topology_node array of nodes with valid addresses.
+ * @param size_t number of nodes.
+ * @return 0 if all addresses are unique and 1 otherwise.
+ */
+static int check_unique_addresses(const topology_node *nodes, size_t count) {
+  node_address *addresses = malloc(count * sizeof(node_address));
+  if (addresses == NULL) {
+    perror("addresses: memory allocation error");
+    return 1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    char host[64];
+    struct in_addr addr;
+
+    snprintf(host, 64, "%.*s", (int)strcspn(nodes[i].address, "/"), nodes[i].address);
+    inet_pton(AF_INET, host, &addr);
+    addresses[i] = (node_address){ntohl(addr.s_addr), nodes[i].name};
+  }
+  qsort(addresses, count, sizeof(node_address), compare_addresses);
+
+  int status = 0;
+  for (size_t i = 1; i < count; i++) {
+    if (addresses[i-1].addr == addresses[i].addr) {
+      fprintf(stderr, "inventory: nodes %s and %s have the same address\n",
+        addresses[i-1].name, addresses[i].name);
+      status = 1;
+      break;
+    }
+  }
+
+  free(addresses);
+
+  return status;
+}
+
+topology_node *topology_read_inventory(const char *path, topology_kind kind, size_t *count) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror("file reading error");
+    return NULL;
+  }
+
+  topology_node *nodes = NULL;
+  size_t capacity = 0;
+  char buffer[512];
+  int line = 0;
+
+  *count = 0;
+
+  while (fgets(buffer, 512, file) != NULL) {
+    line++;
+    buffer[strcspn(buffer, "\r\n")] = '\0';
+    if (buffer[0] == '#' || buffer[strspn(buffer, " \t")] == '\0') continue;
+
+    if (*count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      topology_node *ptr_new = realloc(nodes, capacity * sizeof(topology_node));
+      if (ptr_new == NULL) {
+        perror("nodes: memory allocation error");
+        free(nodes);
+        fclose(file);
+        return NULL;
+      }
+      nodes = ptr_new;
+    }
+
+    topology_node *node = &nodes[*count];
+    memset(node, 0, sizeof(topology_node));
+
+    int fields = sscanf(buffer, "%63s %63s %127s %63s",
+      node->name, node->address, node->endpoint, node->priv_key_hash);
+
+    char network[64];
+    if (fields < 3 || strchr(node->name, '/') != NULL ||
+        network_of(node->address, network) != 0 ||
+        (fields == 4 && !valid_key(node->priv_key_hash))) {
+      fprintf(stderr, "inventory line %d: wrong format\n", line);
+      free(nodes);
+      fclose(file);
+      return NULL;
+    }
+
+    if (strcmp(node->endpoint, "-") == 0) {
+      node->endpoint[0] = '\0';
+    } else {
+      // Without a port the node would get an Endpoint that nobody listens on.
+      const char *port = endpoint_port(node->endpoint);
+      if (port == NULL) {
+        fprintf(stderr, "inventory line %d: endpoint %s needs host:port\n", line, node->endpoint);
+        free(nodes);
+        fclose(file);
+        return NULL;
+      }
+      snprintf(node->listen_port, 16, "%s", port);
+    }
+
+    (*count)++;
+  }
+
+  fclose(file);
+
+  if (*count > 0 && (check_unique_names(nodes, *count) != 0 || check_unique_addresses(nodes, *count) != 0)) {
+    free(nodes);
+    return NULL;
+  }
+
+  // Spokes only know the hub, it has to be reachable.
+  if (*count > 0 && kind == TOPOLOGY_HUB && nodes[0].endpoint[0] == '\0') {
+    fprintf(stderr, "inventory: the hub %s needs an endpoint\n", nodes[0].name);
+    free(nodes);
+    return NULL;
+  }
+
+  return nodes;
+}
+
+/**
+ * Nodes are interleaved between workers: node i goes to worker i % workers.
+ *
+ * @param size_t number of nodes.
+ * @param function called in a worker process for every node of its share.
+ * @param void context passed to the function.
+ * @return 0 if all workers succeeded and 1 on error.
+ */
+static int run_workers(size_t count, int (*job)(size_t, void*), void *ctx) {
+  long workers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (workers < 1) workers = 1;
+  if ((size_t)workers > count) workers = count;
+
+  // Buffered output would otherwise be printed once per worker.
+  fflush(stdout);
+
+  for (long w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("fork error");
+      while (wait(NULL) > 0);
+      return 1;
+    }
+    if (pid == 0) {
+      int status = 0;
+      for (size_t i = w; i < count; i += workers)
+        if (job(i, ctx) != 0) status = 1;
+      _exit(status);
+    }
+  }
+
+  int status = 0, wstatus;
+  while (wait(&wstatus) > 0)
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) status = 1;
+
+  return status;
+}
+
+/**
+ * @param size_t index of the node.
+ * @param void shared array of nodes.
+ * @return 0 if successful and 1 on error.
+ */
+static int generate_node_keys(size_t i, void *ctx) {
+  topology_node *node = &((topology_node*)ctx)[i];
+  char *genkey[] = {"wg", "genkey", NULL};
+  char *pubkey[] = {"wg", "pubkey", NULL};
+
+  if (node->priv_key_hash[0] == '\0' &&
+      exec_read_line(genkey, NULL, node->priv_key_hash, 64) != 0) {
+    perror("keys failed to generate");
+    return 1;
+  }
+
+  if (exec_read_line(pubkey, node->priv_key_hash, node->pub_key_hash, 64) != 0) {
+    perror("keys failed to generate");
+    return 1;
+  }
+
+  return 0;
+}
+
+int topology_generate_keys(topology_node *nodes, size_t count) {
+  size_t size = count * sizeof(topology_node);
+
+  // Workers write the keys straight into memory shared with the parent.
+  topology_node *shared = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("shared nodes: memory allocation error");
+    return 1;
+  }
+  memcpy(shared, nodes, size);
+
+  int status = run_workers(count, generate_node_keys, shared);
+  if (status == 0) memcpy(nodes, shared, size);
+
+  munmap(shared, size);
+
+  if (status != 0) return 1;
+
+  printf("keys for ");
+  printf("\033[32m%zu\033[0m", count);
+  printf(" nodes generated\n");
+
+  return 0;
+}
+
+/**
+ * A node without an endpoint keeps its NAT mapping open toward the peers
+ * it can reach. Two such nodes never meet, keepalive between them is wasted.
+ *
+ * @param FILE config stream.
+ * @param struct topology_node peer to write.
+ * @param char AllowedIPs of the peer.
+ * @param int 1 if the local node needs keepalive to stay reachable.
+ */
+static void write_peer(FILE *fp, const topology_node *peer, const char *allowed, int keepalive) {
+  fprintf(fp, "\n[Peer]\nPublicKey = %s\n", peer->pub_key_hash);
+  if (peer->endpoint[0] != '\0') fprintf(fp, "Endpoint = %s\n", peer->endpoint);
+  fprintf(fp, "AllowedIPs = %s\n", allowed);
+  if (keepalive && peer->endpoint[0] != '\0') fprintf(fp, "PersistentKeepalive = %d\n", KEEPALIVE);
+}
+
+/**
+ * @param struct topology_node array with keys.
+ * @param size_t number of nodes.
+ * @param size_t index of the node whose config is written.
+ * @param enum topology_kind mesh or hub-and-spoke.
+ * @param char output folder.
+ * @return 0 if successful and 1 on error.
+ */
+static int write_node(const topology_node *nodes, size_t count, size_t self,
+                      topology_kind kind, const char *outdir) {
+  const topology_node *node = &nodes[self];
+  char conf[512], allowed[64];
+
+  snprintf(conf, 512, "%s/%s.conf", outdir, node->name);
+
+  int fd = open(conf, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    perror("file creation error");
+    return 1;
+  }
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    perror("file openning error");
+    close(fd);
+    return 1;
+  }
+
+  fputs("[Interface]\n", fp);
+  fprintf(fp, "Address = %s\n", node->address);
+  if (node->listen_port[0] != '\0') fprintf(fp, "ListenPort = %s\n", node->listen_port);
+  fprintf(fp, "PrivateKey = %s\n", node->priv_key_hash);
+  if (kind == TOPOLOGY_HUB && self == 0) {
+    fputs("PostUp = iptables -A FORWARD -i %i -o %i -j ACCEPT\n", fp);
+    fputs("PostDown = iptables -D FORWARD -i %i -o %i -j ACCEPT\n", fp);
+  }
+  fputs("MTU = 1420\n", fp);
+
+  int keepalive = node->endpoint[0] == '\0';
+
+  if (kind == TOPOLOGY_HUB && self != 0) {
+    // Spokes reach each other through the hub, so the hub owns the whole network.
+    network_of(nodes[0].address, allowed);
+    write_peer(fp, &nodes[0], allowed, keepalive);
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      if (i == self) continue;
+      host_of(nodes[i].address, allowed);
+      write_peer(fp, &nodes[i], allowed, keepalive);
+    }
+  }
+
+  if (fclose(fp) != 0) {
+    perror("file writing error");
+    return 1;
+  }
+
+  return 0;
+}
+
+typedef struct {
+  const topology_node *nodes;
+  size_t count;
+  topology_kind kind;
+  const char *outdir;
+} topology_job;
+
+/**
+ * @param size_t index of the node.
+ * @param void struct topology_job.
+ * @return 0 if successful and 1 on error.
+ */
+static int write_node_job(size_t i, void *ctx) {
+  const topology_job *job = ctx;
+
+  return write_node(job->nodes, job->count, i, job->kind, job->outdir);
+}
+
+int topology_create_configs(const topology_node *nodes, size_t count,
+                            topology_kind kind, const char *outdir) {
+  if (mkdir(outdir, 0700) != 0 && errno != EEXIST) {
+    perror("folder creation error");
+    return 1;
+  }
+
+  // Each worker only holds the shared inventory and one open config at a time.
+  topology_job job = {nodes, count, kind, outdir};
+  if (run_workers(count, write_node_job, &job) != 0) return 1;
+
+  printf("\033[32m%zu\033[0m", count);
+  printf(" configs have been created and are located in the ");
+  printf("\033[31m%s\033[0m", outdir);
+  printf("\n");
+
+  return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+typedef enum {
+  TOPOLOGY_MESH,
+  TOPOLOGY_HUB,
+} topology_kind;
+
+typedef struct {
+  char name[64];
+  char address[64];
+  char endpoint[128];
+  char listen_port[16];
+  char priv_key_hash[64];
+  char pub_key_hash[64];
+} topology_node;
+
+/**
+ * One node per line: name address/prefix endpoint [private key].
+ * The endpoint is host:port, or "-" for a node that is not reachable
+ * from the outside. Lines starting with '#' are skipped. Names and
+ * addresses must be unique and the hub, the first node, needs an endpoint.
+ *
+ * @param char inventory file.
+ * @param enum topology_kind mesh or hub-and-spoke.
+ * @param size_t pointer to which the number of nodes will be written.
+ * @return array of nodes or NULL on error.
+ */
+topology_node *topology_read_inventory(const char *path, topology_kind kind, size_t *count);
+
+/**
+ * Generates missing private keys and derives every public key once,
+ * they are shared by all configs that mention the node.
+ *
+ * @param struct topology_node array from topology_read_inventory().
+ * @param size_t number of nodes.
+ * @return 0 if successful and 1 on error.
+ */
+int topology_generate_keys(topology_node *nodes, size_t count);
+
+/**
+ * Mesh: every node gets every other node as a peer, N*(N-1) entries in total.
+ * Hub: the first node of the inventory is the hub, the rest are spokes.
+ * Configs are streamed to <outdir>/<name>.conf by one worker process per CPU.
+ *
+ * @param struct topology_node array with keys.
+ * @param size_t number of nodes.
+ * @param enum topology_kind mesh or hub-and-spoke.
+ * @param char output folder.
+ * @return 0 if successful and 1 on error.
+ */
+int topology_create_configs(const topology_node *nodes, size_t count,
+                            topology_kind kind, const char *outdir);
+
+#endif
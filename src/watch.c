@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "exec.h"
+#include "watch.h"
+#include "wireguard.h"
+
+static int compare_peers(const void *a, const void *b) {
+  return strcmp(((const watch_peer*)a)->pub_key, ((const watch_peer*)b)->pub_key);
+}
+
+/**
+ * @param char file name from the config folder.
+ * @param char pointer to which the server name will be written.
+ * @return 1 if the file is a server config and 0 if not.
+ */
+static int server_name(const char *file, char *name) {
+  size_t len = strlen(file);
+
+  if (len <= 5 || len - 5 >= 64 || strcmp(file + len - 5, ".conf") != 0) return 0;
+
+  snprintf(name, 64, "%.*s", (int)(len - 5), file);
+
+  return 1;
+}
+
+/**
+ * Peers are returned sorted by public key, so two versions of a config
+ * can be compared in a single pass.
+ *
+ * @param char server name.
+ * @param size_t pointer to which the number of peers will be written.
+ * @return array of peers, NULL for a config without peers or on error.
+ */
+static watch_peer *parse_peers(const char *server, size_t *count) {
+  char conf[512];
+
+  #ifdef TEMPDIR
+    snprintf(conf, 512, "%s%s.conf", TMP_WG_PATH, server);
+  #else
+    snprintf(conf, 512, "%s%s.conf", WG_PATH, server);
+  #endif
+
+  *count = 0;
+
+  FILE *file = fopen(conf, "r");
+  if (file == NULL) return NULL;
+
+  watch_peer *peers = NULL;
+  size_t capacity = 0;
+  int in_peer = 0;
+  char buffer[512];
+
+  while (fgets(buffer, 512, file) != NULL) {
+    buffer[strcspn(buffer, "\n")] = '\0';
+
+    if (strcmp(buffer, "[Peer]") == 0) {
+      if (*count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        watch_peer *ptr_new = realloc(peers, capacity * sizeof(watch_peer));
+        if (ptr_new == NULL) {
+          perror("peers: memory allocation error");
+          break;
+        }
+        peers = ptr_new;
+      }
+      memset(&peers[(*count)++], 0, sizeof(watch_peer));
+      in_peer = 1;
+    } else if (buffer[0] == '[') {
+      in_peer = 0;
+    } else if (in_peer && strncmp(buffer, "PublicKey = ", 12) == 0) {
+      snprintf(peers[*count-1].pub_key, 64, "%s", buffer + 12);
+    } else if (in_peer && strncmp(buffer, "AllowedIPs = ", 13) == 0) {
+      // wg set wants the list without spaces.
+      char *dst = peers[*count-1].allowed_ips;
+      for (const char *src = buffer + 13; *src != '\0' && dst - peers[*count-1].allowed_ips < 255; src++)
+        if (*src != ' ') *dst++ = *src;
+      *dst = '\0';
+    }
+  }
+
+  fclose(file);
+
+  if (peers != NULL) qsort(peers, *count, sizeof(watch_peer), compare_peers);
+
+  return peers;
+}
+
+/**
+ * @param char server name.
+ * @param struct watch_peer peer to add or update.
+ * @param int 1 if the peer has been removed from the config.
+ */
+static void push_peer(const char *server, const watch_peer *peer, int removed) {
+  char *add[] = {"wg", "set", (char*)server, "peer", (char*)peer->pub_key,
+                 "allowed-ips", (char*)peer->allowed_ips, NULL};
+  char *remove[] = {"wg", "set", (char*)server, "peer", (char*)peer->pub_key, "remove", NULL};
+
+  if (exec_run(removed ? remove : add, 1) != 0)
+    fprintf(stderr, "wg set %s: interface is not running or rejected the peer\n", server);
+}
+
+/**
+ * Merges two sorted peer lists and reports what has changed.
+ *
+ * @param struct watch_state current state.
+ * @param char server name.
+ * @param struct watch_peer old peers sorted by public key.
+ * @param size_t number of old peers.
+ * @param struct watch_peer new peers sorted by public key.
+ * @param size_t number of new peers.
+ */
+static void diff_peers(const watch_state *state, const char *server,
+                       const watch_peer *old, size_t old_count,
+                       const watch_peer *new, size_t new_count) {
+  size_t i = 0, j = 0;
+
+  while (i < old_count || j < new_count) {
+    int cmp = i == old_count ? 1 : j == new_count ? -1 :
+              strcmp(old[i].pub_key, new[j].pub_key);
+
+    if (cmp < 0) {
+      printf("\033[31m-\033[0m %s peer %s\n", server, old[i].pub_key);
+      if (state->push) push_peer(server, &old[i], 1);
+      i++;
+    } else if (cmp > 0) {
+      printf("\033[32m+\033[0m %s peer %s %s\n", server, new[j].pub_key, new[j].allowed_ips);
+      if (state->push) push_peer(server, &new[j], 0);
+      j++;
+    } else {
+      if (strcmp(old[i].allowed_ips, new[j].allowed_ips) != 0) {
+        printf("\033[33m~\033[0m %s peer %s %s\n", server, new[j].pub_key, new[j].allowed_ips);
+        if (state->push) push_peer(server, &new[j], 0);
+      }
+      i++;
+      j++;
+    }
+  }
+}
+
+/**
+ * @param struct watch_state current state.
+ * @param char server name.
+ * @return the server or NULL if it is not known yet.
+ */
+static watch_server *find_server(watch_state *state, const char *name) {
+  for (size_t i = 0; i < state->count; i++)
+    if (strcmp(state->servers[i].name, name) == 0) return &state->servers[i];
+
+  return NULL;
+}
+
+/**
+ * Reparses one config and applies the difference to the state.
+ *
+ * @param struct watch_state current state.
+ * @param char server name.
+ * @param int 1 if the config is gone.
+ */
+static void refresh_server(watch_state *state, const char *name, int deleted) {
+  watch_server *server = find_server(state, name);
+
+  if (server == NULL) {
+    if (deleted) return;
+    watch_server *ptr_new = realloc(state->servers, (state->count + 1) * sizeof(watch_server));
+    if (ptr_new == NULL) {
+      perror("servers: memory allocation error");
+      return;
+    }
+    state->servers = ptr_new;
+    server = &state->servers[state->count++];
+    snprintf(server->name, 64, "%s", name);
+    server->peers = NULL;
+    server->count = 0;
+    server->entry.name[0] = '\0';
+  }
+
+  size_t count = 0;
+  watch_peer *peers = deleted ? NULL : parse_peers(name, &count);
+
+  // A config that can't be summarized is left out of the index, readers then scan it themselves.
+  if (!deleted && server_index_scan(name, &server->entry) != 0) server->entry.name[0] = '\0';
+
+  if (state->loaded) diff_peers(state, name, server->peers, server->count, peers, count);
+
+  free(server->peers);
+  server->peers = peers;
+  server->count = count;
+
+  if (deleted && state->loaded) {
+    printf("server ");
+    printf("\033[31m%s\033[0m", name);
+    printf(" config has been removed\n");
+  }
+
+  if (deleted) *server = state->servers[--state->count];
+}
+
+/**
+ * Saves the summaries of all servers for wg_client_count_on_servers().
+ *
+ * @param struct watch_state current state.
+ * @param struct timespec mtime of the folder taken before the configs were read.
+ */
+static void save_index(const watch_state *state, const struct timespec *dir_mtime) {
+  server_index idx = {*dir_mtime, NULL, 0};
+
+  idx.entries = malloc((state->count + 1) * sizeof(server_index_entry));
+  if (idx.entries == NULL) {
+    perror("index: memory allocation error");
+    return;
+  }
+
+  for (size_t i = 0; i < state->count; i++) {
+    // Without its entry the folder looks changed to readers and they scan.
+    if (state->servers[i].entry.name[0] == '\0') idx.dir_mtime.tv_nsec = -1;
+    idx.entries[idx.count++] = state->servers[i].entry;
+  }
+
+  server_index_write(&idx);
+  free(idx.entries);
+}
+
+/**
+ * @param char config folder.
+ * @param struct timespec pointer to which the mtime of the folder will be written.
+ */
+static void dir_mtime(const char *path, struct timespec *mtime) {
+  struct stat st;
+
+  if (stat(path, &st) == 0) {
+    *mtime = st.st_mtim;
+  } else {
+    mtime->tv_sec = 0;
+    mtime->tv_nsec = -1;
+  }
+}
+
+/**
+ * Full pass over the folder, used at start and when inotify lost events.
+ *
+ * @param struct watch_state current state.
+ * @param char config folder.
+ * @return 0 if successful and 1 on error.
+ */
+static int rescan(watch_state *state, const char *path) {
+  char conf[512], name[64];
+
+  for (size_t i = state->count; i-- > 0;) {
+    snprintf(name, 64, "%s", state->servers[i].name);
+    snprintf(conf, 512, "%s%s.conf", path, name);
+    if (access(conf, F_OK) != 0) refresh_server(state, name, 1);
+  }
+
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    perror("error when trying to find a folder");
+    return 1;
+  }
+
+  struct dirent *entry;
+
+  while ((entry = readdir(dir)) != NULL)
+    if (server_name(entry->d_name, name)) refresh_server(state, name, 0);
+
+  closedir(dir);
+
+  return 0;
+}
+
+int watch_config_dir(int push) {
+  #ifdef TEMPDIR
+    const char *path = TMP_WG_PATH;
+  #else
+    const char *path = WG_PATH;
+  #endif
+
+  // Subscribe first, so nothing written during the initial scan is missed.
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd == -1) {
+    perror("inotify error");
+    return 1;
+  }
+
+  if (inotify_add_watch(fd, path, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) == -1) {
+    perror("inotify watch error");
+    close(fd);
+    return 1;
+  }
+
+  watch_state state = {NULL, 0, 0, push};
+  struct timespec mtime;
+
+  dir_mtime(path, &mtime);
+  if (rescan(&state, path) != 0) {
+    close(fd);
+    return 1;
+  }
+  save_index(&state, &mtime);
+
+  // The running interfaces already have these peers, only changes are reported.
+  state.loaded = 1;
+
+  printf("watching ");
+  printf("\033[32m%s\033[0m", path);
+  printf(" with %zu servers\n", state.count);
+  fflush(stdout);
+
+  char name[64];
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  for (;;) {
+    ssize_t len = read(fd, buffer, sizeof(buffer));
+    if (len == -1) {
+      if (errno == EINTR) continue;
+      perror("inotify reading error");
+      break;
+    }
+
+    // A server created while this batch is handled makes the saved folder time too old.
+    dir_mtime(path, &mtime);
+
+    for (char *ptr = buffer; ptr < buffer + len;) {
+      const struct inotify_event *event = (const struct inotify_event*)ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // Events were lost, only a full rescan can tell what changed.
+        rescan(&state, path);
+        continue;
+      }
+
+      if (event->len == 0 || !server_name(event->name, name)) continue;
+
+      refresh_server(&state, name, (event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0);
+    }
+
+    save_index(&state, &mtime);
+    fflush(stdout);
+  }
+
+  for (size_t i = 0; i < state.count; i++) free(state.servers[i].peers);
+  free(state.servers);
+  close(fd);
+
+  return 1;
+}
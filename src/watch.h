@@ -0,0 +1,38 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stddef.h>
+
+#include "server_index.h"
+
+typedef struct {
+  char pub_key[64];
+  char allowed_ips[256];
+} watch_peer;
+
+typedef struct {
+  char name[64];
+  watch_peer *peers;
+  size_t count;
+  server_index_entry entry;
+} watch_server;
+
+typedef struct {
+  watch_server *servers;
+  size_t count;
+  int loaded;
+  int push;
+} watch_state;
+
+/**
+ * Reads every config once, then follows the folder with inotify and
+ * reparses only the configs that were written, moved or deleted.
+ * The server index is saved after every change, so --add and --batch
+ * don't have to read the configs. Runs until the process is interrupted.
+ *
+ * @param int 1 to apply peer changes to the running interface with wg set.
+ * @return 1 on error, it doesn't return on success.
+ */
+int watch_config_dir(int push);
+
+#endif
@@ -4,13 +4,22 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <ifaddrs.h>
-#include <dirent.h>
 #include <ctype.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/random.h>
 
 #include "mask.h"
+#include "exec.h"
 #include "wireguard.h"
+#include "server_index.h"
 
 void wg_settings_init(wireguard_settings *wgs) {
+  // Only set for split tunnels, the list can hold thousands of prefixes.
+  wgs->allowed_ips = NULL;
+  // Seconds, 0 leaves PersistentKeepalive out of the client config.
+  wgs->keepalive = KEEPALIVE;
+
   wgs->name = (char*)malloc(64);
   if (wgs->name == NULL) {
     perror("wgs->name: memory allocation error");
@@ -51,6 +60,9 @@ void wg_settings_init(wireguard_settings *wgs) {
     wg_settings_free_memory(wgs);
     return;
   }
+
+  // Keys start empty, so a failed generation can never pass for a key.
+  wgs->priv_key_hash[0] = wgs->pub_key_hash[0] = wgs->pub_temp_hash[0] = '\0';
 }
 
 void wg_settings_free_memory(wireguard_settings *wgs) {
@@ -73,6 +85,9 @@ void wg_settings_free_memory(wireguard_settings *wgs) {
     if (wgs->pub_temp_hash != NULL) {
       free(wgs->pub_temp_hash);
     }
+    if (wgs->allowed_ips != NULL) {
+      free(wgs->allowed_ips);
+    }
     free(wgs);
   }
 }
@@ -122,37 +137,12 @@ static char *return_interface_name() {
   return interface;
 }
 
-/**
- * @param char hash path.
- * @param char pointer to which the hash will be written.
- */
-static int wg_read_hash(const char *path, char **hash) {
-  FILE *file = fopen(path, "r");
-  if (file == NULL) {
-    perror("file reading error");
-    return 1;
-  }
-
-  if (fgets(*hash, 64, file) == NULL) {
-    perror("reading hash error");
-    fclose(file);
-    return 1;
-  }
-  
-  (*hash)[strcspn(*hash, "\n")] = '\0';
-
-  fclose(file);
-
-  return 0;
-}
-
 void wg_stop_systemctl(const char *user) {
-  char shell_stop[256], shell_disable[256];
+  char unit[256];
 
-  snprintf(shell_stop, 256, "systemctl stop wg-quick@%s", user);
-  snprintf(shell_disable, 256, "systemctl disable wg-quick@%s", user);
+  snprintf(unit, 256, "wg-quick@%s", user);
 
-  if (system(shell_stop) != 0 || system(shell_disable) != 0) {
+  if (exec_unit_stop(unit) != 0) {
     perror("systemctl: the service doesn not stop or disabled");
     return;
   }
@@ -163,12 +153,11 @@ void wg_stop_systemctl(const char *user) {
 }
 
 void wg_start_systemctl(const char *user) {
-  char shell_enable[256], shell_start[256];
+  char unit[256];
 
-  snprintf(shell_enable, 256, "systemctl enable wg-quick@%s", user);
-  snprintf(shell_start, 256, "systemctl start wg-quick@%s", user);
+  snprintf(unit, 256, "wg-quick@%s", user);
 
-  if (system(shell_enable) != 0 || system(shell_start) != 0) {
+  if (exec_unit_start(unit) != 0) {
     perror("systemctl: couldn't get the service up and running");
     return;
   }
@@ -179,11 +168,9 @@ void wg_start_systemctl(const char *user) {
 }
 
 void wg_stop_server(const char *user) {
-  char shell[256];
+  char *argv[] = {"wg-quick", "down", (char*)user, NULL};
 
-  snprintf(shell, 256, "wg-quick down %s  > /dev/null 2>&1", user);
-
-  if (system(shell) != 0) {
+  if (exec_run(argv, 1) != 0) {
     perror("couldn't stop the server");
     return;
   }
@@ -194,11 +181,9 @@ void wg_stop_server(const char *user) {
 }
 
 void wg_start_server(const char *user) {
-  char shell[256];
-
-  snprintf(shell, 256, "wg-quick up %s > /dev/null 2>&1", user);
+  char *argv[] = {"wg-quick", "up", (char*)user, NULL};
 
-  if (system(shell) != 0) {
+  if (exec_run(argv, 1) != 0) {
     perror("couldn't get the server running");
     return;
   }
@@ -208,30 +193,26 @@ void wg_start_server(const char *user) {
   printf(" is running\n");
 }
 
-void wg_generate_keys(wireguard_settings *wgs) {
-  char priv_key_path[256], pub_key_path[256], shell[1024];
-
-  snprintf(priv_key_path, 256, "%sprivatekey.%s", TMP, wgs->name);
-  snprintf(pub_key_path, 256, "%spublickey.%s", TMP, wgs->name);
-  snprintf(shell, 1024,
-    "wg genkey | tee %s | wg pubkey | tee %s > /dev/null", priv_key_path, pub_key_path);
+int wg_generate_keys(wireguard_settings *wgs) {
+  char *genkey[] = {"wg", "genkey", NULL};
+  char *pubkey[] = {"wg", "pubkey", NULL};
 
-  if (system(shell) != 0) {
-    perror("keys failed to generate");
-    return;
+  // The private key only ever lives in pipes and memory, never in /tmp.
+  if (exec_read_line(genkey, NULL, wgs->priv_key_hash, 64) != 0 ||
+      exec_read_line(pubkey, wgs->priv_key_hash, wgs->pub_key_hash, 64) != 0) {
+    fprintf(stderr, "keys for %s failed to generate\n", wgs->name);
+    wgs->priv_key_hash[0] = wgs->pub_key_hash[0] = '\0';
+    return 1;
   }
 
   printf("keys for ");
   printf("\033[32m%s\033[0m", wgs->name);
   printf(" generated\n");
 
-  if (wg_read_hash(priv_key_path, &wgs->priv_key_hash) == 0 &&
-      wg_read_hash(pub_key_path, &wgs->pub_key_hash) == 0)
-    if (unlink(priv_key_path) != 0 || unlink(pub_key_path) != 0)
-      perror("failed to delete file");
+  return 0;
 }
 
-void wg_generate_pub_key(wireguard_settings *wgs, const char *server) {
+int wg_generate_pub_key(wireguard_settings *wgs, const char *server) {
   char conf[512];
 
   #ifdef TEMPDIR
@@ -243,10 +224,10 @@ void wg_generate_pub_key(wireguard_settings *wgs, const char *server) {
   FILE *file = fopen(conf, "r");
   if (file == NULL) {
     perror("file openning error");
-    return;
+    return 1;
   }
 
-  char buffer_temp[256], buffer_priv_key[64];
+  char buffer_temp[256], buffer_priv_key[64] = "";
 
   while (fgets(buffer_temp, 256, file) != NULL) {
     if (strncmp(buffer_temp, "PrivateKey = ", 13) == 0) {
@@ -258,26 +239,23 @@ void wg_generate_pub_key(wireguard_settings *wgs, const char *server) {
 
   fclose(file);
 
-  char pub_key_path[256], shell[512];
-
-  snprintf(pub_key_path, 256, "%spublickey.%s", TMP, server);
-  snprintf(shell, 512, "echo '%s' | wg pubkey > %s", buffer_priv_key, pub_key_path);
+  char *pubkey[] = {"wg", "pubkey", NULL};
 
-  if (system(shell) != 0) {
-    perror("keys failed to generate");
-    return;
+  if (buffer_priv_key[0] == '\0' ||
+      exec_read_line(pubkey, buffer_priv_key, wgs->pub_temp_hash, 64) != 0) {
+    fprintf(stderr, "public key for %s failed to generate\n", server);
+    wgs->pub_temp_hash[0] = '\0';
+    return 1;
   }
 
   printf("public key for ");
   printf("\033[32m%s\033[0m", server);
   printf(" generated\n");
 
-  if (wg_read_hash(pub_key_path, &wgs->pub_temp_hash) == 0)
-    if (unlink(pub_key_path) != 0)
-      perror("failed to delete file");
+  return 0;
 }
 
-void wg_create_config_server(wireguard_settings *wgs) {
+void wg_create_config_server(wireguard_settings *wgs, int forwarder) {
   char conf[512];
 
   #ifdef TEMPDIR
@@ -301,15 +279,46 @@ void wg_create_config_server(wireguard_settings *wgs) {
 
   char *interface = return_interface_name();
 
-  char address[64], listenPort[64], privateKey[128], postUp[256], postDown[256];
+  char address[128], listenPort[64], privateKey[128], postUp[640], postDown[512];
+  // Type=notify: systemd-run returns once the forwarder is bound, or fails if it couldn't.
+  const char *dnsUp = forwarder ? "; systemd-run --unit=ww-dns-%i -p Type=notify ww --dns %i" : "";
+  const char *dnsDown = forwarder ? "; systemctl stop ww-dns-%i || true" : "";
 
-  snprintf(address, 64, "Address = %s/%d\n", wgs->subnetwork, MASK_SERVER);
+  #ifdef IPV6ENABLE
+    /*
+     * Unique local prefix fdXX:XXXX:XXXX:N::/64 (RFC 4193) with a random global ID,
+     * so that the number of clients isn't limited by the /28 any more.
+     */
+    unsigned char global_id[5];
+    int server_number = 0;
+
+    sscanf(wgs->subnetwork, "10.0.%d.", &server_number);
+    if (getrandom(global_id, 5, 0) != 5) {
+      perror("getrandom error");
+      fclose(fp);
+      free(interface);
+      return;
+    }
+
+    snprintf(address, 128, "Address = %s/%d, fd%02x:%02x%02x:%02x%02x:%x::1/%d\n",
+      wgs->subnetwork, MASK_SERVER, global_id[0], global_id[1], global_id[2],
+      global_id[3], global_id[4], server_number, MASK_SERVER6);
+    snprintf(postUp, 640, "PostUp = iptables -A FORWARD -i %%i -j ACCEPT; \
+iptables -t nat -A POSTROUTING -o %s -j MASQUERADE; \
+sysctl -q -w net.ipv6.conf.all.forwarding=1; ip6tables -A FORWARD -i %%i -j ACCEPT; \
+ip6tables -t nat -A POSTROUTING -o %s -j MASQUERADE; ww --shape %%i || true%s\n", interface, interface, dnsUp);
+    snprintf(postDown, 512, "PostDown = iptables -D FORWARD -i %%i -j ACCEPT; \
+iptables -t nat -D POSTROUTING -o %s -j MASQUERADE; ip6tables -D FORWARD -i %%i -j ACCEPT; \
+ip6tables -t nat -D POSTROUTING -o %s -j MASQUERADE%s\n", interface, interface, dnsDown);
+  #else
+    snprintf(address, 128, "Address = %s/%d\n", wgs->subnetwork, MASK_SERVER);
+    snprintf(postUp, 640, "PostUp = iptables -A FORWARD -i %%i -j ACCEPT; \
+iptables -t nat -A POSTROUTING -o %s -j MASQUERADE; ww --shape %%i || true%s\n", interface, dnsUp);
+    snprintf(postDown, 512, "PostDown = iptables -D FORWARD -i %%i -j ACCEPT; \
+iptables -t nat -D POSTROUTING -o %s -j MASQUERADE%s\n", interface, dnsDown);
+  #endif
   snprintf(listenPort, 64, "ListenPort = %s\n", wgs->port);
   snprintf(privateKey, 128, "PrivateKey = %s\n", wgs->priv_key_hash);
-  snprintf(postUp, 256, "PostUp = iptables -A FORWARD -i %%i -j ACCEPT; \
-iptables -t nat -A POSTROUTING -o %s -j MASQUERADE\n", interface);
-  snprintf(postDown, 256, "PostDown = iptables -D FORWARD -i %%i -j ACCEPT; \
-iptables -t nat -D POSTROUTING -o %s -j MASQUERADE\n", interface);
 
   fputs("[Interface]\n", fp);
   fputs(address, fp);
@@ -328,27 +337,36 @@ iptables -t nat -D POSTROUTING -o %s -j MASQUERADE\n", interface);
   free(interface);
 }
 
-void wg_create_config_client(wireguard_settings *wgs, const char *publicip, const char *issue) {
-  char conf[512];
-
-  snprintf(conf, 512, "%s%s.conf", TMP, wgs->name);
-
-  int fd = open(conf, O_WRONLY | O_CREAT | O_TRUNC, 0664);
-  if (fd == -1) {
-    perror("file creation error");
-    return;
+/**
+ * @param char client addresses "10.0.x.y/32, fd..::y/128", either can be missing.
+ * @param int address family of the wanted address.
+ * @param char pointer to which the address without the prefix length will be written.
+ * @return 0 if the client has an address of that family and 1 if not.
+ */
+static int client_address(const char *subnetwork, int family, char *address) {
+  char list[64];
+  snprintf(list, 64, "%s", subnetwork);
+
+  for (char *save = NULL, *token = strtok_r(list, ", ", &save); token != NULL;
+       token = strtok_r(NULL, ", ", &save)) {
+    unsigned char addr[16];
+    token[strcspn(token, "/")] = '\0';
+    if (inet_pton(family, token, addr) == 1) {
+      snprintf(address, INET6_ADDRSTRLEN, "%s", token);
+      return 0;
+    }
   }
-  close(fd);
 
-  FILE *fp = fopen(conf, "w");
-  if (fp == NULL) {
-    perror("file openning error");
-    return;
-  }
+  return 1;
+}
 
-  char address[64], privateKey[128], publicKey[128], endpoint[256];
+void wg_write_config_client(FILE *fp, wireguard_settings *wgs, const char *publicip, const char *issue) {
+  char address[128], privateKey[128], publicKey[128], endpoint[256];
+  char address4[INET6_ADDRSTRLEN], address6[INET6_ADDRSTRLEN];
+  int has4 = client_address(wgs->subnetwork, AF_INET, address4) == 0;
+  int has6 = client_address(wgs->subnetwork, AF_INET6, address6) == 0;
 
-  snprintf(address, 64, "Address = %s\n", wgs->subnetwork);
+  snprintf(address, 128, "Address = %s\n", wgs->subnetwork);
   snprintf(privateKey, 128, "PrivateKey = %s\n", wgs->priv_key_hash);
   snprintf(publicKey, 128, "PublicKey = %s\n", wgs->pub_temp_hash);
   snprintf(endpoint, 256, "Endpoint = %s:%s\n", publicip, wgs->port);
@@ -356,32 +374,92 @@ void wg_create_config_client(wireguard_settings *wgs, const char *publicip, cons
   fputs("[Interface]\n", fp);
   fputs(address, fp);
   fputs(privateKey, fp);
-  if (strcmp(issue, "yes") == 0) fputs("DNS = 1.1.1.1\n", fp);
+  // The forwarder started by ww --dns listens on the first IPv4 address of the subnetwork,
+  // IPv6-only clients fall back to a public resolver they can reach.
+  if (strcmp(issue, "local") == 0 && has4)
+    fprintf(fp, "DNS = %.*s.1\n", (int)(strrchr(address4, '.') - address4), address4);
+  else if (strcmp(issue, "yes") == 0 || strcmp(issue, "local") == 0)
+    fputs(has4 ? "DNS = 1.1.1.1\n" : "DNS = 2606:4700:4700::1111\n", fp);
   fputs("\n", fp);
   fputs("[Peer]\n", fp);
   fputs(publicKey, fp);
   fputs(endpoint, fp);
-  fputs("AllowedIPs = 0.0.0.0/0\n", fp);
-  fputs("PersistentKeepalive = 20\n", fp);
+  if (wgs->allowed_ips != NULL && has6) {
+    // The split tunnel list is IPv4 only, the /64 of the server keeps the other clients reachable.
+    struct in6_addr addr6;
+    char prefix6[INET6_ADDRSTRLEN];
+
+    inet_pton(AF_INET6, address6, &addr6);
+    memset(addr6.s6_addr + 8, 0, 8);
+    inet_ntop(AF_INET6, &addr6, prefix6, INET6_ADDRSTRLEN);
+    fprintf(fp, "AllowedIPs = %s, %s/%d\n", wgs->allowed_ips, prefix6, MASK_SERVER6);
+  } else if (wgs->allowed_ips != NULL) {
+    fprintf(fp, "AllowedIPs = %s\n", wgs->allowed_ips);
+  } else {
+    // An IPv6-only client has no source address for IPv4, so only ::/0 goes through the server.
+    if (has4 && has6) fputs("AllowedIPs = 0.0.0.0/0, ::/0\n", fp);
+    else if (has6) fputs("AllowedIPs = ::/0\n", fp);
+    else fputs("AllowedIPs = 0.0.0.0/0\n", fp);
+  }
+  if (wgs->keepalive > 0) fprintf(fp, "PersistentKeepalive = %d\n", wgs->keepalive);
+}
+
+int wg_create_config_client(wireguard_settings *wgs, const char *publicip, const char *issue) {
+  char conf[512];
+
+  snprintf(conf, 512, "%s%s.conf", TMP, wgs->name);
+
+  /*
+   * The config holds the private key of the client, nobody else may read it.
+   * /tmp is shared: a symlink or a file planted there by another user is
+   * refused, and an old config of ours loses any wider mode it had.
+   */
+  int fd = open(conf, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    perror("file creation error");
+    return 1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != geteuid()) {
+    fprintf(stderr, "%s belongs to someone else, the config isn't written\n", conf);
+    close(fd);
+    return 1;
+  }
+  if (fchmod(fd, 0600) != 0 || ftruncate(fd, 0) != 0) {
+    perror("file creation error");
+    close(fd);
+    return 1;
+  }
+
+  FILE *fp = fdopen(fd, "w");
+  if (fp == NULL) {
+    perror("file openning error");
+    close(fd);
+    return 1;
+  }
+
+  wg_write_config_client(fp, wgs, publicip, issue);
+
+  if (ferror(fp) != 0 || fclose(fp) != 0) {
+    perror("config writing error");
+    return 1;
+  }
 
   printf("\033[32m%s.conf\033[0m", wgs->name);
   printf(" has been created and is located in the ");
   printf("\033[31m%s\033[0m", TMP);
   printf("\n");
 
-  fclose(fp);
-
-  char shell[512];
+  // The QR code is only a convenience, the config itself is already written.
+  char *qrencode[] = {"qrencode", "-t", "ansiutf8", "-s", "1", "-l", "L", "-r", conf, NULL};
 
-  snprintf(shell, 512, "qrencode -t ansiutf8 -s 1 -l L < %s%s.conf", TMP, wgs->name);
+  if (exec_run(qrencode, 0) != 0) fprintf(stderr, "couldn't generate qrcode\n");
 
-  if (system(shell) != 0) {
-    perror("couldn't generate qrcode");
-    return;
-  }
+  return 0;
 }
 
-void wg_add_client_in_config(wireguard_settings *wgs, const char *config_name) {
+int wg_add_client_in_config(wireguard_settings *wgs, const char *config_name) {
   char conf[512];
 
   #ifdef TEMPDIR
@@ -393,7 +471,7 @@ void wg_add_client_in_config(wireguard_settings *wgs, const char *config_name) {
   FILE *fp = fopen(conf, "a");
   if (fp == NULL) {
     perror("file openning error");
-    return;
+    return 1;
   }
 
   char publicKey[128], allowedIPs[128];
@@ -405,33 +483,30 @@ void wg_add_client_in_config(wireguard_settings *wgs, const char *config_name) {
   fputs(publicKey, fp);
   fputs(allowedIPs, fp);
 
-  fclose(fp);
+  if (ferror(fp) != 0 || fclose(fp) != 0) {
+    perror("config writing error");
+    return 1;
+  }
 
   printf("\033[32m%s\033[0m", wgs->name);
   printf(" has been added to the config\n");
+
+  return 0;
 }
 
 int wg_init_settings_server(char *server, char *subnetwork, char *port) {
-  #ifdef TEMPDIR
-    DIR *dir = opendir(TMP_WG_PATH);
-  #else
-    DIR *dir = opendir(WG_PATH);
-  #endif
-  if (dir == NULL) return 1;
-
-  struct dirent *entry;
+  server_index idx;
+  if (server_index_get(&idx) != 0) return 1;
 
   for (int i = 0; i < 10; i++) {
     char buffer_server[16];
-    snprintf(buffer_server, 16, "wg%d.conf", i);
+    snprintf(buffer_server, 16, "wg%d", i);
 
-    rewinddir(dir);
-    while ((entry = readdir(dir)) != NULL) {
-      if (strcmp(entry->d_name, buffer_server) == 0)
-        break;
-    }
+    size_t j = 0;
+    while (j < idx.count && strcmp(idx.entries[j].name, buffer_server) != 0) j++;
 
-    if (entry == NULL) {
+    if (j == idx.count) {
+      server_index_free(&idx);
       snprintf(server, 64, "wg%d", i);
       snprintf(subnetwork, 64, "10.0.%d.1", i);
       snprintf(port, 32, "%d", PORT+i);
@@ -439,10 +514,52 @@ int wg_init_settings_server(char *server, char *subnetwork, char *port) {
     }
   }
 
+  server_index_free(&idx);
+
   return 1;
 }
 
-int wg_init_settings_client(const char *server, char *subnetwork, char *port) {
+/**
+ * Takes the ULA prefix of the server from an Address line. wg-quick writes
+ * one line per address when it saves the config, so any line can hold it.
+ *
+ * @param char value of the Address line.
+ * @param char pointer to which the first 64 bits of the address will be written.
+ * @return 0 if a ULA address was found and 1 if not.
+ */
+static int parse_ula_prefix(const char *addresses, unsigned char *prefix) {
+  char list[512];
+  snprintf(list, 512, "%s", addresses);
+
+  for (char *save = NULL, *token = strtok_r(list, ", ", &save); token != NULL;
+       token = strtok_r(NULL, ", ", &save)) {
+    struct in6_addr addr;
+    token[strcspn(token, "/")] = '\0';
+    // fc00::/7, link-local and global addresses are not ours.
+    if (inet_pton(AF_INET6, token, &addr) == 1 && (addr.s6_addr[0] & 0xfe) == 0xfc) {
+      memcpy(prefix, addr.s6_addr, 8);
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+typedef struct {
+  const char *key;
+  int index;
+} peer_key;
+
+static int compare_keys(const void *a, const void *b) {
+  return strcmp(((const peer_key*)a)->key, ((const peer_key*)b)->key);
+}
+
+int wg_pool_load(const char *server, wg_address_pool *pool) {
+  return wg_pool_load_peers(server, pool, NULL, NULL, 0);
+}
+
+int wg_pool_load_peers(const char *server, wg_address_pool *pool, const char *const *pub_keys,
+                       char (*allowed)[64], int count) {
   char conf[512];
 
   #ifdef TEMPDIR
@@ -451,106 +568,222 @@ int wg_init_settings_client(const char *server, char *subnetwork, char *port) {
     snprintf(conf, 512, "%s%s.conf", WG_PATH, server);
   #endif
 
-  int server_number = 0;
+  memset(pool, 0, sizeof(wg_address_pool));
   for (const char *s = server; *s != '\0'; s++)
     if (isdigit(*s))
-      server_number = server_number * 10 + (*s - '0');
+      pool->server_number = pool->server_number * 10 + (*s - '0');
 
-  snprintf(port, 32, "%d", PORT+server_number);
+  FILE *file = fopen(conf, "r");
+  if (file == NULL) {
+    perror("file reading error");
+    return 1;
+  }
 
-  for (int i = 2; i <= 14; i++) {
-    FILE *file = fopen(conf, "r");
-    if (file == NULL) {
-      perror("file reading error");
-      return -1;
+  // Sorted keys: every PublicKey line costs a binary search, not a scan of the group.
+  peer_key *keys = NULL;
+  if (count > 0) {
+    keys = malloc(count * sizeof(peer_key));
+    if (keys == NULL) {
+      perror("keys: memory allocation error");
+      fclose(file);
+      return 1;
+    }
+    for (int i = 0; i < count; i++) {
+      keys[i].key = pub_keys[i];
+      keys[i].index = i;
+      allowed[i][0] = '\0';
     }
+    qsort(keys, count, sizeof(peer_key), compare_keys);
+  }
 
-    int flag = 1;
-    char buffer[256], buffer_temp[128];
+  // One pass over the config marks every address that is already taken.
+  char buffer[512];
+  peer_key *match = NULL;
 
-    snprintf(buffer_temp, 128,
-      "AllowedIPs = 10.0.%d.%d/%d\n", server_number, i, MASK_CLIENT);
+  while (fgets(buffer, 512, file) != NULL) {
+    buffer[strcspn(buffer, "\n")] = '\0';
 
-    while (fgets(buffer, 256, file) != NULL) {
-      if (strcmp(buffer, buffer_temp) == 0) {
-        flag = 0;
-        break;
+    if (strncmp(buffer, "Address = ", 10) == 0 && !pool->has_prefix6) {
+      pool->has_prefix6 = parse_ula_prefix(buffer + 10, pool->prefix6) == 0;
+      continue;
+    }
+    if (strcmp(buffer, "[Peer]") == 0) {
+      match = NULL;
+      continue;
+    }
+    if (strncmp(buffer, "PublicKey = ", 12) == 0 && keys != NULL) {
+      peer_key wanted = {buffer + 12, 0};
+      match = bsearch(&wanted, keys, count, sizeof(peer_key), compare_keys);
+      // A key queued twice gets the same answer for both.
+      while (match != NULL && match > keys && strcmp(match[-1].key, match->key) == 0) match--;
+      continue;
+    }
+    if (strncmp(buffer, "AllowedIPs = ", 13) != 0) continue;
+
+    for (peer_key *k = match; k != NULL && k < keys + count && strcmp(k->key, match->key) == 0; k++)
+      snprintf(allowed[k->index], 64, "%s", buffer + 13);
+    match = NULL;
+
+    for (char *save = NULL, *token = strtok_r(buffer + 13, ", ", &save); token != NULL;
+         token = strtok_r(NULL, ", ", &save)) {
+      struct in_addr addr;
+      struct in6_addr addr6;
+
+      token[strcspn(token, "/")] = '\0';
+
+      if (inet_pton(AF_INET, token, &addr) == 1) {
+        unsigned char *b = (unsigned char*)&addr.s_addr;
+        if (b[0] == 10 && b[1] == 0 && b[2] == pool->server_number && b[3] <= CLIENTS_SERVER)
+          pool->used[b[3]] = 1;
+      } else if (pool->has_prefix6 && inet_pton(AF_INET6, token, &addr6) == 1 &&
+                 memcmp(addr6.s6_addr, pool->prefix6, 8) == 0 &&
+                 memcmp(addr6.s6_addr + 8, "\0\0\0\0\0\0", 6) == 0) {
+        unsigned int host = (addr6.s6_addr[14] << 8) | addr6.s6_addr[15];
+        pool->used6[host / 8] |= 1 << (host % 8);
       }
     }
+  }
 
-    fclose(file);
+  fclose(file);
+  free(keys);
 
-    if (flag == 1) {
-      snprintf(subnetwork, 64, "10.0.%d.%d/%d", server_number, i, MASK_CLIENT);
-      return 0;
-    }
-  }
+  return 0;
+}
 
-  return 1;
+/**
+ * @param struct wg_address_pool loaded with wg_pool_load().
+ * @param int host number.
+ * @return 1 if the IPv6 host is taken and 0 if not.
+ */
+static int used6(const wg_address_pool *pool, int host) {
+  return (pool->used6[host / 8] >> (host % 8)) & 1;
 }
 
 /**
- * The number of users in the configuration file.
- * 
- * @param char configuration file.
- * @return 0-14 the number of users or -1 on error.
+ * Only the ULA prefix can give addresses once IPv4 is exhausted.
+ *
+ * @param struct wg_address_pool loaded with wg_pool_load().
+ * @return 1 if the pool gives out IPv6 addresses and 0 if not.
  */
-static int number_of_users(const char *filename) {
-  FILE *file = fopen(filename, "r");
-  if (file == NULL) {
-    perror("file reading error");
-    return -1;
-  }
+static int dual_stack(const wg_address_pool *pool) {
+  #ifdef IPV6ENABLE
+    return pool->has_prefix6;
+  #else
+    (void)pool;
+    return 0;
+  #endif
+}
 
+int wg_pool_capacity(const wg_address_pool *pool) {
+  return dual_stack(pool) ? CLIENTS_SERVER6 - 1 : CLIENTS_SERVER - 1;
+}
+
+int wg_pool_free(const wg_address_pool *pool) {
   int count = 0;
-  char buffer[512];
 
-  while (fgets(buffer, 512, file) != NULL) {
-    buffer[strcspn(buffer, "\n")] = 0;
-    if (strcmp(buffer, "[Peer]") == 0) count++;
+  if (dual_stack(pool)) {
+    for (int i = 2; i <= CLIENTS_SERVER6; i++) count += !used6(pool, i);
+  } else {
+    for (int i = 2; i <= CLIENTS_SERVER; i++) count += !pool->used[i];
   }
 
-  fclose(file);
-
   return count;
 }
 
-int wg_client_count_on_servers(char **server) {
-  #ifdef TEMPDIR
-    DIR *dir = opendir(TMP_WG_PATH);
-  #else
-    DIR *dir = opendir(WG_PATH);
-  #endif
-  if (dir == NULL) return 1;
+int wg_pool_allocate(wg_address_pool *pool, char *subnetwork) {
+  int host = 0;
+  for (int i = 2; i <= CLIENTS_SERVER; i++) {
+    if (!pool->used[i]) {
+      host = i;
+      break;
+    }
+  }
 
-  struct dirent *entry;
+  /*
+   * Servers created before dual-stack have no ULA prefix and stay IPv4-only.
+   * Otherwise the client keeps the same host number in both families while
+   * IPv4 lasts and gets an IPv6-only address after that.
+   */
+  if (dual_stack(pool)) {
+    int host6 = 0;
+    if (host != 0 && !used6(pool, host)) {
+      host6 = host;
+    } else {
+      for (int i = 2; i <= CLIENTS_SERVER6; i++) {
+        if (!used6(pool, i)) {
+          host6 = i;
+          break;
+        }
+      }
+    }
 
-  int flag = 1;
-  int count = 0;
-  char buffer_path[512];
-
-  while ((entry = readdir(dir)) != NULL) {
-    if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
-      #ifdef TEMPDIR
-        snprintf(buffer_path, 512, "%s%s", TMP_WG_PATH, entry->d_name);
-      #else
-        snprintf(buffer_path, 512, "%s%s", WG_PATH, entry->d_name);
-      #endif
-
-      count = number_of_users(buffer_path);
-      if (count == -1) return 1;
-      
-      flag = 0;
-
-      printf(">server: ");
-      if (strlen(entry->d_name) > 5) entry->d_name[strlen(entry->d_name)-5] = '\0';
-      printf("\033[32m%s\033[0m\n", entry->d_name);
-      printf("          |__ clients: ");
-      printf("\033[31m%d\033[0m", count);
-      printf("/14\n");
+    if (host6 != 0) {
+      struct in6_addr addr6;
+      char address6[INET6_ADDRSTRLEN];
+
+      memset(&addr6, 0, sizeof(addr6));
+      memcpy(addr6.s6_addr, pool->prefix6, 8);
+      addr6.s6_addr[14] = host6 >> 8;
+      addr6.s6_addr[15] = host6 & 0xff;
+      inet_ntop(AF_INET6, &addr6, address6, INET6_ADDRSTRLEN);
+
+      pool->used6[host6 / 8] |= 1 << (host6 % 8);
+      if (host != 0) {
+        pool->used[host] = 1;
+        snprintf(subnetwork, 64, "10.0.%d.%d/%d, %s/%d",
+          pool->server_number, host, MASK_CLIENT, address6, MASK_CLIENT6);
+      } else {
+        snprintf(subnetwork, 64, "%s/%d", address6, MASK_CLIENT6);
+      }
+      return 0;
     }
   }
 
+  if (host == 0) return 1;
+
+  pool->used[host] = 1;
+  snprintf(subnetwork, 64, "10.0.%d.%d/%d", pool->server_number, host, MASK_CLIENT);
+
+  return 0;
+}
+
+int wg_init_settings_client(const char *server, char *subnetwork, char *port) {
+  wg_address_pool *pool = malloc(sizeof(wg_address_pool));
+  if (pool == NULL) {
+    perror("pool: memory allocation error");
+    return -1;
+  }
+
+  if (wg_pool_load(server, pool) != 0) {
+    free(pool);
+    return -1;
+  }
+
+  snprintf(port, 32, "%d", PORT+pool->server_number);
+  int status = wg_pool_allocate(pool, subnetwork);
+
+  free(pool);
+
+  return status;
+}
+
+int wg_client_count_on_servers(char **server) {
+  // Kept up to date by ww --watch, otherwise refreshed here when a config has changed.
+  server_index idx;
+  if (server_index_get(&idx) != 0) return 1;
+
+  int flag = idx.count == 0;
+
+  for (size_t i = 0; i < idx.count; i++) {
+    printf(">server: ");
+    printf("\033[32m%s\033[0m\n", idx.entries[i].name);
+    printf("          |__ clients: ");
+    printf("\033[31m%d\033[0m", idx.entries[i].peers);
+    printf("/%d\n", idx.entries[i].capacity);
+  }
+
+  server_index_free(&idx);
+
   // The flag signals that the folder was empty.
   if (flag == 1) {
     perror("configuration files not found");
@@ -1,8 +1,17 @@
 #ifndef WIREGUARD_H
 #define WIREGUARD_H
 
-#define TMP "/tmp/"
-#define TMP_WG_PATH "/tmp/wireguard/"
+#include <stdio.h>
+
+#include "mask.h"
+
+// Folders of TEMPDIR builds, the tests move them into their build folder.
+#ifndef TMP
+  #define TMP "/tmp/"
+#endif
+#ifndef TMP_WG_PATH
+  #define TMP_WG_PATH "/tmp/wireguard/"
+#endif
 #define WG_PATH "/etc/wireguard/"
 
 typedef struct {
@@ -12,6 +21,8 @@ typedef struct {
   char *priv_key_hash;
   char *pub_key_hash;
   char *pub_temp_hash;
+  char *allowed_ips;
+  int keepalive;
 } wireguard_settings;
 
 /**
@@ -55,15 +66,72 @@ void wg_start_server(const char *user);
  */
 int wg_init_settings_server(char *server, char *subnetwork, char *port);
 
+/**
+ * Addresses of one server that are taken by its peers.
+ */
+typedef struct {
+  int server_number;
+  int has_prefix6;
+  unsigned char prefix6[8];
+  unsigned char used[CLIENTS_SERVER+1];
+  unsigned char used6[CLIENTS_SERVER6/8+1];
+} wg_address_pool;
+
+/**
+ * Reads the server config once and marks the addresses of all peers.
+ *
+ * @param char wg interface name.
+ * @param struct wg_address_pool to fill, about 8 KB.
+ * @return 0 if successful and 1 on error.
+ */
+int wg_pool_load(const char *server, wg_address_pool *pool);
+
+/**
+ * Same single pass as wg_pool_load(), it also looks for the [Peer] of each
+ * public key so a whole commit group needs one read of the config.
+ *
+ * @param char wg interface name.
+ * @param struct wg_address_pool to fill.
+ * @param char public keys to look for.
+ * @param char pointer to which AllowedIPs of each key will be written, "" if it has no peer.
+ * @param int number of keys.
+ * @return 0 if successful and 1 on error.
+ */
+int wg_pool_load_peers(const char *server, wg_address_pool *pool, const char *const *pub_keys,
+                       char (*allowed)[64], int count);
+
+/**
+ * Takes the next free address, see wg_init_settings_client().
+ *
+ * @param struct wg_address_pool loaded with wg_pool_load().
+ * @param char pointer to which the client addresses will be written.
+ * @return 0 if successful and 1 if the server is full.
+ */
+int wg_pool_allocate(wg_address_pool *pool, char *subnetwork);
+
+/**
+ * @param struct wg_address_pool loaded with wg_pool_load().
+ * @return number of addresses that can still be given out.
+ */
+int wg_pool_free(const wg_address_pool *pool);
+
+/**
+ * @param struct wg_address_pool loaded with wg_pool_load().
+ * @return number of clients the server can hold at all.
+ */
+int wg_pool_capacity(const wg_address_pool *pool);
+
 /**
  * 32 bits - 28 bits of mask = 4 bits for hosts. 2^4 = 16 IP addresses in total.
  * Reserved addresses: network address (10.0.x.0) / broadcast address (10.0.x.15).
  * Available addresses for the client from 10.0.x.2/32 to 10.0.x.14/32.
+ * With IPV6ENABLE the client also gets the same host in the ULA /64 of the
+ * server, and only an IPv6 address once the /28 is full.
  * 
  * @param char wg interface name.
- * @param char subnetwork pointer from [Peer].
+ * @param char subnetwork pointer from [Peer], "10.0.x.y/32[, fd..::y/128]".
  * @param char port pointer from [Interface].
- * @return 0 if successful and 1 on error.
+ * @return 0 if successful, 1 if the server is full and -1 on error.
  */
 int wg_init_settings_client(const char *server, char *subnetwork, char *port);
 
@@ -78,30 +146,49 @@ int wg_client_count_on_servers(char **server);
 /**
  * @param struct wireguard_settings with all user information.
  * @param char private key pointer generated from [Interface].
+ * @return 0 if successful and 1 on error.
+ */
+int wg_generate_pub_key(wireguard_settings *wgs, const char *server);
+
+/**
+ * @param struct wireguard_settings with all user information.
+ * @return 0 if successful and 1 on error, the keys are empty then.
  */
-void wg_generate_pub_key(wireguard_settings *wgs, const char *server);
+int wg_generate_keys(wireguard_settings *wgs);
 
 /**
  * @param struct wireguard_settings with all user information.
+ * @param int 1 to start the ww --dns forwarder in PostUp, a failed start fails wg-quick up.
  */
-void wg_generate_keys(wireguard_settings *wgs);
+void wg_create_config_server(wireguard_settings *wgs, int forwarder);
 
 /**
+ * AllowedIPs of the client is wgs->allowed_ips for a split tunnel,
+ * or 0.0.0.0/0 when it is NULL.
+ *
+ * @param FILE stream to which the config will be written.
  * @param struct wireguard_settings with all user information.
+ * @param char public ip from get_ip_address().
+ * @param char yes/no/local to the question about adding dns.
  */
-void wg_create_config_server(wireguard_settings *wgs);
+void wg_write_config_client(FILE *fp, wireguard_settings *wgs, const char *publicip, const char *issue);
 
 /**
+ * Writes the config with wg_write_config_client() to /tmp/<name>.conf
+ * and prints it as a QR code.
+ *
  * @param struct wireguard_settings with all user information.
  * @param char public ip from get_ip_address().
- * @param char yes/no to the question about adding dns.
+ * @param char yes/no/local to the question about adding dns.
+ * @return 0 if the config is written and 1 on error.
  */
-void wg_create_config_client(wireguard_settings *wgs, const char *publicip, const char *issue);
+int wg_create_config_client(wireguard_settings *wgs, const char *publicip, const char *issue);
 
 /**
  * @param struct wireguard_settings with all user information.
  * @param char name of the config to which the client will be added.
+ * @return 0 if successful and 1 on error.
  */
-void wg_add_client_in_config(wireguard_settings *wgs, const char *config_name);
+int wg_add_client_in_config(wireguard_settings *wgs, const char *config_name);
 
 #endif
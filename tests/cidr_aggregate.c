@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "cidr.h"
+#include "test.h"
+
+#define MAX_RANGES 16
+
+/**
+ * @param char prefixes separated by spaces.
+ * @param struct cidr_range array to which the ranges will be written (MAX_RANGES).
+ * @return number of ranges.
+ */
+static size_t ranges_of(const char *prefixes, cidr_range *ranges) {
+  char list[512], *save = NULL;
+  size_t count = 0;
+
+  snprintf(list, 512, "%s", prefixes);
+  for (char *p = strtok_r(list, " ", &save); p != NULL && count < MAX_RANGES; p = strtok_r(NULL, " ", &save))
+    if (cidr_parse(p, &ranges[count]) == 0) count++;
+
+  return count;
+}
+
+/**
+ * @param char prefixes separated by spaces.
+ * @param char expected list after normalizing and formatting.
+ * @return 1 if the list is the expected one and 0 otherwise.
+ */
+static int aggregates_to(const char *prefixes, const char *expected) {
+  cidr_range ranges[MAX_RANGES];
+  size_t count = cidr_normalize(ranges, ranges_of(prefixes, ranges));
+
+  char *list = cidr_format(ranges, count);
+  int same = list != NULL && strcmp(list, expected) == 0;
+  if (!same) fprintf(stderr, "%s: got \"%s\", expected \"%s\"\n", prefixes, list ? list : "(null)", expected);
+  free(list);
+
+  return same;
+}
+
+/**
+ * @param char prefixes to keep, separated by spaces.
+ * @param char prefixes to remove, separated by spaces.
+ * @param char expected list.
+ * @return 1 if the list is the expected one and 0 otherwise.
+ */
+static int subtracts_to(const char *include, const char *exclude, const char *expected) {
+  cidr_range in[MAX_RANGES], ex[MAX_RANGES], out[2 * MAX_RANGES];
+  size_t in_count = cidr_normalize(in, ranges_of(include, in));
+  size_t ex_count = cidr_normalize(ex, ranges_of(exclude, ex));
+
+  char *list = cidr_format(out, cidr_subtract(in, in_count, ex, ex_count, out));
+  int same = list != NULL && strcmp(list, expected) == 0;
+  if (!same) fprintf(stderr, "%s - %s: got \"%s\", expected \"%s\"\n", include, exclude, list ? list : "(null)", expected);
+  free(list);
+
+  return same;
+}
+
+int main(void) {
+  cidr_range range;
+
+  expect(cidr_parse("10.1.2.3/8", &range) == 0 && range.first == 0x0a000000 && range.last == 0x0affffff,
+    "host bits are cleared");
+  expect(cidr_parse("0.0.0.0/0", &range) == 0 && range.first == 0 && range.last == 0xffffffff, "/0 is everything");
+  expect(cidr_parse("192.0.2.1", &range) == 0 && range.first == range.last, "a bare address is a /32");
+  expect(cidr_parse("192.0.2.0/33", &range) != 0 && cidr_parse("192.0.2.0/", &range) != 0 &&
+    cidr_parse("192.0.2/24", &range) != 0 && cidr_parse("192.0.2.0/2x", &range) != 0, "wrong prefixes are errors");
+
+  expect(aggregates_to("10.0.0.0/25 10.0.0.128/25", "10.0.0.0/24"), "adjacent halves merge");
+  expect(aggregates_to("10.0.0.0/24 10.0.1.0/24 10.0.2.0/24", "10.0.0.0/23, 10.0.2.0/24"),
+    "adjacent ranges merge into the fewest prefixes");
+  expect(aggregates_to("10.0.1.0/24 10.0.2.0/24", "10.0.1.0/24, 10.0.2.0/24"),
+    "adjacent ranges across a prefix boundary stay two prefixes");
+  expect(aggregates_to("10.0.0.0/8 10.1.2.0/24 10.255.255.255/32", "10.0.0.0/8"), "nested prefixes disappear");
+  expect(aggregates_to("10.1.2.0/24 10.0.0.0/8", "10.0.0.0/8"), "a nested prefix before its parent disappears");
+  expect(aggregates_to("192.0.2.1/32 192.0.2.2/32", "192.0.2.1/32, 192.0.2.2/32"), "/32s that don't align stay");
+  expect(aggregates_to("192.0.2.2/32 192.0.2.3/32", "192.0.2.2/31"), "aligned /32s merge");
+  expect(aggregates_to("0.0.0.0/0 10.0.0.0/8 255.255.255.255/32", "0.0.0.0/0"), "everything absorbs the rest");
+  expect(aggregates_to("255.255.255.254/32 255.255.255.255/32", "255.255.255.254/31"),
+    "the last address doesn't wrap around");
+  expect(aggregates_to("0.0.0.0/32 0.0.0.1/32", "0.0.0.0/31"), "the first address merges");
+  expect(aggregates_to("203.0.113.0/24 10.0.0.0/24 192.0.2.0/24 10.0.1.0/24",
+    "10.0.0.0/23, 192.0.2.0/24, 203.0.113.0/24"), "unsorted input is sorted");
+  expect(aggregates_to("192.0.2.0/24 192.0.2.0/24 192.0.2.7 192.0.2.0/24", "192.0.2.0/24"),
+    "duplicates are merged");
+  expect(aggregates_to("", ""), "no prefixes give an empty list");
+
+  expect(subtracts_to("0.0.0.0/0", "0.0.0.0/1", "128.0.0.0/1"), "the lower half of everything is removed");
+  expect(subtracts_to("0.0.0.0/0", "10.0.0.0/8 172.16.0.0/12 192.168.0.0/16",
+    "0.0.0.0/5, 8.0.0.0/7, 11.0.0.0/8, 12.0.0.0/6, 16.0.0.0/4, 32.0.0.0/3, 64.0.0.0/2, 128.0.0.0/3, "
+    "160.0.0.0/5, 168.0.0.0/6, 172.0.0.0/12, 172.32.0.0/11, 172.64.0.0/10, 172.128.0.0/9, "
+    "173.0.0.0/8, 174.0.0.0/7, 176.0.0.0/4, 192.0.0.0/9, 192.128.0.0/11, 192.160.0.0/13, "
+    "192.169.0.0/16, 192.170.0.0/15, 192.172.0.0/14, 192.176.0.0/12, 192.192.0.0/10, "
+    "193.0.0.0/8, 194.0.0.0/7, 196.0.0.0/6, 200.0.0.0/5, 208.0.0.0/4, 224.0.0.0/3"),
+    "private networks are cut out of everything");
+  expect(subtracts_to("10.0.0.0/24", "10.0.0.0/24", ""), "removing everything leaves nothing");
+  expect(subtracts_to("10.0.0.0/24", "10.0.0.0/8", ""), "a larger exclude removes everything");
+  expect(subtracts_to("10.0.0.0/24", "10.0.0.0/32 10.0.0.255/32", "10.0.0.1/32, 10.0.0.2/31, 10.0.0.4/30, "
+    "10.0.0.8/29, 10.0.0.16/28, 10.0.0.32/27, 10.0.0.64/26, 10.0.0.128/26, 10.0.0.192/27, 10.0.0.224/28, "
+    "10.0.0.240/29, 10.0.0.248/30, 10.0.0.252/31, 10.0.0.254/32"), "both ends are cut off");
+  expect(subtracts_to("10.0.0.0/24 10.0.2.0/24", "10.0.1.0/24", "10.0.0.0/24, 10.0.2.0/24"),
+    "an exclude between includes changes nothing");
+  expect(subtracts_to("255.255.255.0/24", "255.255.255.255/32", "255.255.255.0/25, 255.255.255.128/26, "
+    "255.255.255.192/27, 255.255.255.224/28, 255.255.255.240/29, 255.255.255.248/30, 255.255.255.252/31, "
+    "255.255.255.254/32"), "the last address is removed without wrapping around");
+
+  if (test_failed == 0) printf("cidr aggregate: all checks passed\n");
+
+  return test_failed;
+}
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "cidr.h"
+#include "test.h"
+
+#define INCLUDES 100000
+#define EXCLUDES 10000
+#define INCLUDE TMP "bench-include.txt"
+#define EXCLUDE TMP "bench-exclude.txt"
+// Every prefix is inside 10.0.0.0/8, a bitmap of it checks the result address by address.
+#define NETWORK 0x0a000000u
+#define ADDRESSES (1u << 24)
+
+/**
+ * @param struct timespec start of the interval.
+ * @return milliseconds elapsed since start.
+ */
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * Random prefixes from /24 to /32, unsorted, nested and adjacent like real feeds.
+ *
+ * @param char file to write.
+ * @param int number of prefixes.
+ * @param char bitmap of 10.0.0.0/8 in which the covered addresses are set or cleared.
+ * @param int 1 to set the addresses for includes and 0 to clear them for excludes.
+ * @return 0 if successful and 1 on error.
+ */
+static int write_prefixes(const char *path, int count, unsigned char *bitmap, int value) {
+  FILE *fp = fopen(path, "w");
+  if (fp == NULL) return 1;
+
+  for (int i = 0; i < count; i++) {
+    int len = 24 + rand() % 9;
+    uint32_t size = 1u << (32 - len);
+    uint32_t first = (NETWORK | ((uint32_t)rand() & (ADDRESSES - 1))) & ~(size - 1);
+
+    fprintf(fp, "%u.%u.%u.%u/%d\n", first >> 24, (first >> 16) & 0xff, (first >> 8) & 0xff, first & 0xff, len);
+    for (uint32_t a = first - NETWORK; a < first - NETWORK + size; a++) {
+      if (value) bitmap[a >> 3] |= 1 << (a & 7);
+      else bitmap[a >> 3] &= ~(1 << (a & 7));
+    }
+  }
+
+  return fclose(fp) != 0;
+}
+
+/**
+ * @param char list from cidr_format().
+ * @param char bitmap that every listed address is cleared in, it has to be set.
+ * @return 0 if the prefixes are all expected and don't overlap and 1 otherwise.
+ */
+static int clear_listed(char *list, unsigned char *bitmap) {
+  cidr_range range;
+
+  for (char *save = NULL, *p = strtok_r(list, ", ", &save); p != NULL; p = strtok_r(NULL, ", ", &save)) {
+    if (cidr_parse(p, &range) != 0 || range.first < NETWORK || range.last >= NETWORK + ADDRESSES) return 1;
+    for (uint64_t a = range.first - NETWORK; a <= range.last - NETWORK; a++) {
+      if (!(bitmap[a >> 3] & (1 << (a & 7)))) return 1;
+      bitmap[a >> 3] &= ~(1 << (a & 7));
+    }
+  }
+
+  return 0;
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  unsigned char *bitmap = calloc(ADDRESSES / 8, 1);
+  if (bitmap == NULL) return 1;
+
+  // The excludes are written last, they win over the includes in the bitmap.
+  srand(31);
+  if (write_prefixes(INCLUDE, INCLUDES, bitmap, 1) != 0 || write_prefixes(EXCLUDE, EXCLUDES, bitmap, 0) != 0) {
+    perror("prefix list writing error");
+    return 1;
+  }
+
+  cidr_range *in = NULL, *ex = NULL;
+  size_t in_count = 0, ex_count = 0;
+  struct timespec start;
+
+  // The same steps as --include/--exclude.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int status = cidr_read_file(INCLUDE, &in, &in_count) || cidr_read_file(EXCLUDE, &ex, &ex_count);
+  double read_ms = elapsed_ms(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  in_count = cidr_normalize(in, in_count);
+  ex_count = cidr_normalize(ex, ex_count);
+  double normalize_ms = elapsed_ms(&start);
+
+  cidr_range *out = malloc((in_count + ex_count) * sizeof(cidr_range));
+  if (status != 0 || out == NULL) return 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t count = cidr_subtract(in, in_count, ex, ex_count, out);
+  double subtract_ms = elapsed_ms(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  char *list = cidr_format(out, count);
+  double format_ms = elapsed_ms(&start);
+
+  size_t prefixes = 0;
+  for (char *c = list; c != NULL && *c != '\0'; c++) prefixes += *c == '/';
+
+  expect(list != NULL && clear_listed(list, bitmap) == 0, "only included addresses are listed, each once");
+  int left = 0;
+  for (size_t i = 0; i < ADDRESSES / 8; i++) left |= bitmap[i];
+  expect(left == 0, "every included address is listed");
+
+  printf("%d include and %d exclude prefixes -> %zu ranges, %zu prefixes\n",
+    INCLUDES, EXCLUDES, count, prefixes);
+  printf("read: %.1f ms, normalize: %.1f ms, subtract: %.1f ms, format: %.1f ms\n",
+    read_ms, normalize_ms, subtract_ms, format_ms);
+
+  free(list);
+  free(out);
+  free(in);
+  free(ex);
+  free(bitmap);
+  unlink(INCLUDE);
+  unlink(EXCLUDE);
+
+  return test_failed;
+}
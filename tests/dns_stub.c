@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "dns.h"
+#include "test.h"
+
+#define MAX_SEEN 64
+#define NAMES 20
+#define ROUNDS 25
+// Every upstream answer takes this long, like a resolver a few hops away.
+#define UPSTREAM_DELAY_US 5000
+#define NOTIFY TMP "notify"
+
+// Written by the stub upstream, read by the test.
+typedef struct {
+  int udp;
+  int tcp;
+  uint16_t ids[MAX_SEEN];
+  uint16_t ports[MAX_SEEN];
+} stub_stats;
+
+static stub_stats *stats;
+/**
+ * @return monotonic time in microseconds.
+ */
+static long now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * @param uint16_t query ID.
+ * @param char name like "a.test".
+ * @param uint16_t QTYPE, 1 for A.
+ * @param char pointer to which the query will be written.
+ * @return size of the query.
+ */
+static size_t build_query(uint16_t id, const char *name, uint16_t type, unsigned char *msg) {
+  size_t off = 12;
+
+  memset(msg, 0, 12);
+  msg[0] = id >> 8;
+  msg[1] = id;
+  msg[2] = 0x01;
+  msg[5] = 1;
+
+  while (*name != '\0') {
+    size_t len = strcspn(name, ".");
+    msg[off++] = len;
+    memcpy(msg + off, name, len);
+    off += len;
+    name += len + (name[len] == '.');
+  }
+  msg[off++] = 0;
+  msg[off++] = type >> 8;
+  msg[off++] = type;
+  // IN
+  msg[off++] = 0;
+  msg[off++] = 1;
+
+  return off;
+}
+
+/**
+ * Appends an OPT record like stub resolvers with EDNS send it.
+ *
+ * @param char query.
+ * @param size_t query size.
+ * @param uint16_t UDP payload size the client takes.
+ * @param int 1 to set the DO bit.
+ * @return size of the query with the record.
+ */
+static size_t add_opt(unsigned char *msg, size_t len, uint16_t size, int dnssec) {
+  const unsigned char opt[] = {0, 0, 41, size >> 8, size & 0xff, 0, 0, dnssec ? 0x80 : 0, 0, 0, 0};
+
+  msg[11] = 1;
+  memcpy(msg + len, opt, sizeof(opt));
+
+  return len + sizeof(opt);
+}
+
+/**
+ * Answers with one A record and a TTL of 300, names starting with "big"
+ * only get a truncated answer over UDP.
+ *
+ * @param char query, turned into the answer.
+ * @param size_t query size.
+ * @param int 1 if the query came over TCP.
+ * @return size of the answer.
+ */
+static size_t stub_answer(unsigned char *msg, size_t len, int tcp) {
+  static const unsigned char record[] = {
+    0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 192, 0, 2, 1,
+  };
+
+  msg[2] |= 0x80;
+  if (!tcp && memcmp(msg + 13, "big", 3) == 0) {
+    msg[2] |= 0x02;
+    return len;
+  }
+
+  msg[7] = 1;
+  memcpy(msg + len, record, sizeof(record));
+
+  return len + sizeof(record);
+}
+
+/**
+ * Upstream resolver for the forwarder, UDP and TCP on the same port.
+ *
+ * @param int UDP socket.
+ * @param int TCP listening socket.
+ */
+static void stub_upstream(int udp, int tcp) {
+  unsigned char msg[512];
+  struct pollfd fds[2] = {{udp, POLLIN, 0}, {tcp, POLLIN, 0}};
+
+  while (poll(fds, 2, -1) > 0) {
+    if (fds[0].revents & POLLIN) {
+      struct sockaddr_in from;
+      socklen_t from_len = sizeof(from);
+      ssize_t n = recvfrom(udp, msg, 256, 0, (struct sockaddr*)&from, &from_len);
+      if (n < 12) continue;
+
+      if (stats->udp < MAX_SEEN) {
+        stats->ids[stats->udp] = (msg[0] << 8) | msg[1];
+        stats->ports[stats->udp] = ntohs(from.sin_port);
+      }
+      stats->udp++;
+
+      usleep(UPSTREAM_DELAY_US);
+      size_t len = stub_answer(msg, n, 0);
+      sendto(udp, msg, len, 0, (struct sockaddr*)&from, from_len);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      int client = accept(tcp, NULL, NULL);
+      if (client == -1) continue;
+
+      // DNS over TCP: two bytes of length, then the message.
+      ssize_t n = read(client, msg, 258);
+      if (n > 14) {
+        stats->tcp++;
+        size_t len = stub_answer(msg + 2, n - 2, 1);
+        msg[0] = len >> 8;
+        msg[1] = len;
+        if (write(client, msg, len + 2) == -1) perror("stub: tcp writing error");
+      }
+      close(client);
+    }
+  }
+}
+
+/**
+ * @param int port of the forwarder.
+ * @param char query.
+ * @param size_t query size.
+ * @return socket the query was sent from, recv() gets the answer, or -1 on error.
+ */
+static int send_query(int port, const unsigned char *query, size_t len) {
+  struct sockaddr_in addr = {0};
+  struct timeval timeout = {0, 300000};
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd == -1) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (sendto(fd, query, len, 0, (struct sockaddr*)&addr, sizeof(addr)) != (ssize_t)len) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * @param int port of the forwarder.
+ * @param char query.
+ * @param size_t query size.
+ * @param char pointer to which the answer will be written (512 bytes).
+ * @return size of the answer or -1 without an answer.
+ */
+static ssize_t ask_query(int port, const unsigned char *query, size_t len, unsigned char *answer) {
+  int fd = send_query(port, query, len);
+  if (fd == -1) return -1;
+
+  ssize_t n = recv(fd, answer, 512, 0);
+  close(fd);
+
+  return n;
+}
+
+/**
+ * @param int port of the forwarder.
+ * @param char name to ask for.
+ * @param uint16_t query ID.
+ * @param char pointer to which the answer will be written (512 bytes).
+ * @return size of the answer or -1 without an answer.
+ */
+static ssize_t ask_udp(int port, const char *name, uint16_t id, unsigned char *answer) {
+  unsigned char query[256];
+
+  return ask_query(port, query, build_query(id, name, 1, query), answer);
+}
+
+/**
+ * @param int port of the forwarder.
+ * @param char name to ask for.
+ * @param char pointer to which the answer without the length will be written (512 bytes).
+ * @return size of the answer or -1 without an answer.
+ */
+static ssize_t ask_tcp(int port, const char *name, unsigned char *answer) {
+  struct sockaddr_in addr = {0};
+  struct timeval timeout = {1, 0};
+  unsigned char query[258], buffer[514];
+  size_t len = build_query(0x4242, name, 1, query + 2);
+
+  query[0] = len >> 8;
+  query[1] = len;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd == -1) return -1;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  ssize_t n = -1;
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+      write(fd, query, len + 2) == (ssize_t)(len + 2))
+    n = read(fd, buffer, sizeof(buffer));
+  close(fd);
+
+  if (n < 2) return -1;
+  memcpy(answer, buffer + 2, n - 2);
+
+  return n - 2;
+}
+
+/**
+ * @param int SOCK_DGRAM or SOCK_STREAM.
+ * @param int port or 0 for any free one.
+ * @return socket bound to 127.0.0.1 or -1 on error.
+ */
+static int bind_loopback(int type, int port) {
+  struct sockaddr_in addr = {0};
+  int fd = socket(AF_INET, type, 0), on = 1;
+  if (fd == -1) return -1;
+
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      (type == SOCK_STREAM && listen(fd, 2 * DNS_TCP_MAX) != 0)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Stands in for systemd, the forwarder reports to it once it listens.
+ *
+ * @return socket that NOTIFY_SOCKET points to or -1 on error.
+ */
+static int notify_socket(void) {
+  struct sockaddr_un addr = {0};
+  struct timeval timeout = {2, 0};
+  int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if (fd == -1) return -1;
+
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", NOTIFY);
+  unlink(NOTIFY);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || setenv("NOTIFY_SOCKET", NOTIFY, 1) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/**
+ * Waits a moment for the relays of the forwarder, then accepts their connections.
+ *
+ * @param int listening socket of an upstream that never answers.
+ * @param int array to which the accepted sockets will be appended.
+ * @param int number of sockets already in the array.
+ * @return number of sockets in the array now.
+ */
+static int accept_relays(int upstream, int *accepted, int count) {
+  usleep(300000);
+
+  int fd;
+  while (count < 2 * DNS_TCP_MAX && (fd = accept(upstream, NULL, NULL)) != -1)
+    accepted[count++] = fd;
+
+  return count;
+}
+
+/**
+ * @param int bound socket.
+ * @return its port.
+ */
+static int port_of(int fd) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+
+  return getsockname(fd, (struct sockaddr*)&addr, &len) == 0 ? ntohs(addr.sin_port) : -1;
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  stats = mmap(NULL, sizeof(stub_stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats == MAP_FAILED) return 1;
+  memset(stats, 0, sizeof(stub_stats));
+
+  int udp = bind_loopback(SOCK_DGRAM, 0);
+  int tcp = udp != -1 ? bind_loopback(SOCK_STREAM, port_of(udp)) : -1;
+  // The forwarder binds the port itself, it is only reserved here to find a free one.
+  int probe = bind_loopback(SOCK_DGRAM, 0);
+  int notify = notify_socket();
+  if (tcp == -1 || probe == -1 || notify == -1) {
+    perror("test sockets error");
+    return 1;
+  }
+  int stub_port = port_of(udp), port = port_of(probe);
+  close(probe);
+
+  fflush(stdout);
+  pid_t stub = fork();
+  if (stub == 0) {
+    stub_upstream(udp, tcp);
+    _exit(0);
+  }
+  close(udp);
+  close(tcp);
+
+  char listen[32], upstream[32];
+  snprintf(listen, 32, "127.0.0.1:%d", port);
+  snprintf(upstream, 32, "127.0.0.1:%d", stub_port);
+
+  pid_t forwarder = fork();
+  // exit() and not _exit(), the statistics printed on SIGTERM have to be flushed.
+  if (forwarder == 0) exit(dns_forwarder(listen, upstream));
+
+  unsigned char answer[512];
+  char ready[16] = "";
+
+  // The forwarder reports once both sockets are bound, the first query needs no retries.
+  ssize_t n = recv(notify, ready, 15, 0);
+  expect(n == 7 && strcmp(ready, "READY=1") == 0, "the forwarder tells systemd once it listens");
+  close(notify);
+  unlink(NOTIFY);
+
+  n = ask_udp(port, "a.test", 0x1111, answer);
+  expect(n > 12 && answer[0] == 0x11 && answer[1] == 0x11, "the answer carries the client ID");
+  n = ask_udp(port, "a.test", 0x2222, answer);
+  expect(n > 12 && answer[0] == 0x22 && answer[7] == 1, "the cached answer has the new ID");
+  expect(stats->udp == 1, "the second question is answered from the cache");
+
+  ask_udp(port, "b.test", 1, answer);
+  ask_udp(port, "c.test", 2, answer);
+  ask_udp(port, "d.test", 3, answer);
+  expect(stats->udp == 4, "new names go upstream");
+  expect(!(stats->ports[1] == stats->ports[2] && stats->ports[2] == stats->ports[3]),
+    "upstream queries leave from different ports");
+  expect(!(stats->ids[2] == (uint16_t)(stats->ids[1] + 1) && stats->ids[3] == (uint16_t)(stats->ids[2] + 1)),
+    "upstream IDs are not sequential");
+
+  // Only the labels are case-insensitive, QTYPE 65 (HTTPS) and 97 differ in the 0x20 bit.
+  unsigned char query[256];
+  int before = stats->udp;
+  ask_query(port, query, build_query(6, "A.Test", 65, query), answer);
+  ask_query(port, query, build_query(7, "a.test", 97, query), answer);
+  expect(stats->udp == before + 2, "QTYPEs are not lowercased");
+  ask_query(port, query, build_query(8, "a.TEST", 65, query), answer);
+  expect(stats->udp == before + 2, "names are compared without case");
+
+  // A client that takes large answers or DNSSEC records gets an answer fetched for it.
+  before = stats->udp;
+  n = ask_query(port, query, add_opt(query, build_query(9, "a.test", 1, query), 1232, 0), answer);
+  expect(n > 12 && answer[1] == 9 && stats->udp == before + 1, "an EDNS question goes upstream");
+  ask_query(port, query, add_opt(query, build_query(10, "a.test", 1, query), 1232, 0), answer);
+  expect(stats->udp == before + 1, "the same EDNS question is answered from the cache");
+  ask_query(port, query, add_opt(query, build_query(11, "a.test", 1, query), 4096, 0), answer);
+  ask_query(port, query, add_opt(query, build_query(12, "a.test", 1, query), 1232, 1), answer);
+  expect(stats->udp == before + 3, "payload size and DO bit are part of the key");
+  ask_udp(port, "a.test", 13, answer);
+  expect(stats->udp == before + 3, "the answer without EDNS is still cached");
+
+  // Identical questions sent before the first answer is back share one upstream query.
+  int waiting[8];
+  before = stats->udp;
+  for (int i = 0; i < 8; i++) waiting[i] = send_query(port, query, build_query(0x100 + i, "same.test", 1, query));
+  for (int i = 0; i < 8; i++) {
+    n = waiting[i] != -1 ? recv(waiting[i], answer, 512, 0) : -1;
+    expect(n > 12 && answer[0] == 1 && answer[1] == i && answer[7] == 1, "every client gets its own answer");
+    if (waiting[i] != -1) close(waiting[i]);
+  }
+  expect(stats->udp == before + 1, "identical questions go upstream once");
+
+  before = stats->udp;
+  n = ask_udp(port, "big.test", 4, answer);
+  expect(n > 12 && (answer[2] & 0x02), "a truncated answer is passed on");
+  ask_udp(port, "big.test", 5, answer);
+  expect(stats->udp == before + 2, "a truncated answer is not cached");
+
+  n = ask_tcp(port, "big.test", answer);
+  expect(n > 12 && answer[0] == 0x42 && answer[7] == 1 && !(answer[2] & 0x02), "TCP gets the full answer");
+  expect(stats->tcp == 1, "TCP is relayed to the upstream");
+
+  // Benchmark: the same names again and again, like clients refreshing their lookups.
+  char name[32];
+  long miss_us = 0, hit_us = 0;
+  int misses = 0, hits = 0;
+  before = stats->udp;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < NAMES; i++) {
+      snprintf(name, 32, "host%d.bench", i);
+      int upstream_before = stats->udp;
+      long start = now_us();
+      if (ask_udp(port, name, round * NAMES + i, answer) < 0) {
+        expect(0, "every benchmark query is answered");
+        continue;
+      }
+      long spent = now_us() - start;
+      if (stats->udp != upstream_before) {
+        miss_us += spent;
+        misses++;
+      } else {
+        hit_us += spent;
+        hits++;
+      }
+    }
+  }
+
+  kill(forwarder, SIGTERM);
+  waitpid(forwarder, NULL, 0);
+  kill(stub, SIGTERM);
+  waitpid(stub, NULL, 0);
+
+  // Relay limit: every relay keeps a connection to an upstream that never answers.
+  int silent = bind_loopback(SOCK_STREAM, 0), clients[DNS_TCP_MAX + 1], accepted[2 * DNS_TCP_MAX];
+  probe = bind_loopback(SOCK_DGRAM, 0);
+  notify = notify_socket();
+  if (silent == -1 || probe == -1 || notify == -1 || fcntl(silent, F_SETFL, O_NONBLOCK) == -1) {
+    perror("test sockets error");
+    return 1;
+  }
+  port = port_of(probe);
+  close(probe);
+  snprintf(listen, 32, "127.0.0.1:%d", port);
+  snprintf(upstream, 32, "127.0.0.1:%d", port_of(silent));
+
+  fflush(stdout);
+  forwarder = fork();
+  if (forwarder == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) dup2(null, STDOUT_FILENO);
+    exit(dns_forwarder(listen, upstream));
+  }
+  expect(recv(notify, ready, 15, 0) == 7, "the second forwarder listens");
+  close(notify);
+  unlink(NOTIFY);
+
+  struct sockaddr_in addr = {0};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int i = 0; i <= DNS_TCP_MAX; i++) {
+    clients[i] = socket(AF_INET, SOCK_STREAM, 0);
+    if (clients[i] == -1 || connect(clients[i], (struct sockaddr*)&addr, sizeof(addr)) != 0)
+      expect(0, "the forwarder takes every connection into its backlog");
+  }
+
+  int relayed = accept_relays(silent, accepted, 0);
+  expect(relayed == DNS_TCP_MAX, "no more than DNS_TCP_MAX connections are relayed");
+  close(clients[0]);
+  relayed = accept_relays(silent, accepted, relayed);
+  expect(relayed == DNS_TCP_MAX + 1, "a queued connection is relayed once another one ends");
+
+  kill(forwarder, SIGTERM);
+  waitpid(forwarder, NULL, 0);
+  for (int i = 1; i <= DNS_TCP_MAX; i++) close(clients[i]);
+  for (int i = 0; i < relayed; i++) close(accepted[i]);
+  close(silent);
+
+  expect(stats->udp - before == NAMES, "every name goes upstream once");
+
+  printf("%d queries for %d names: hit rate %.1f%%, miss %ld us, hit %ld us on average\n",
+    ROUNDS * NAMES, NAMES, 100.0 * hits / (ROUNDS * NAMES),
+    misses ? miss_us / misses : 0, hits ? hit_us / hits : 0);
+
+  if (test_failed == 0) printf("dns: all checks passed\n");
+
+  return test_failed;
+}
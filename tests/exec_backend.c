@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "exec.h"
+#include "test.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+int main(void) {
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) return 1;
+  wg_settings_init(wgs);
+  snprintf(wgs->name, 64, "client");
+
+  fake_exec_install();
+
+  // Units go through the backend as a whole, never as a systemctl command line.
+  wg_start_systemctl("wg9");
+  wg_stop_systemctl("wg9");
+  expect(fake_exec_count("unit start wg-quick@wg9") == 1, "wg-quick@wg9 is started");
+  expect(fake_exec_count("unit stop wg-quick@wg9") == 1, "wg-quick@wg9 is stopped");
+  expect(fake_exec_size == 2, "nothing else is run for units");
+
+  // The D-Bus backend needs full unit names, systemctl completes them itself.
+  char name[32];
+  expect(exec_unit_name("wg-quick@wg9", name, 32) == 0 && strcmp(name, "wg-quick@wg9.service") == 0,
+    "a unit without type is a service");
+  expect(exec_unit_name("wg-quick@wg9.service", name, 32) == 0 &&
+    strcmp(name, "wg-quick@wg9.service") == 0, "a service keeps its name");
+  expect(exec_unit_name("ww-dns.timer", name, 32) == 0 && strcmp(name, "ww-dns.timer") == 0,
+    "other unit types keep their name");
+  expect(exec_unit_name("wg-quick@wg9.0", name, 32) == 0 && strcmp(name, "wg-quick@wg9.0.service") == 0,
+    "a dot in the instance is no type");
+  expect(exec_unit_name("wg-quick@a-very-long-interface-name", name, 32) != 0, "a long name is an error");
+
+  fake_exec_reset();
+  wg_start_server("wg9");
+  wg_stop_server("wg9");
+  expect(fake_exec_count("wg-quick up wg9") == 1, "wg-quick up is run");
+  expect(fake_exec_count("wg-quick down wg9") == 1, "wg-quick down is run");
+
+  // The private key goes to wg pubkey through stdin, not as an argument.
+  fake_exec_reset();
+  fake_exec_output("key=\n");
+  expect(wg_generate_keys(wgs) == 0, "keys are generated");
+  expect(strcmp(wgs->priv_key_hash, "key=") == 0 && strcmp(wgs->pub_key_hash, "key=") == 0,
+    "keys are read without the newline");
+  expect(fake_exec_count("wg genkey") == 1 && fake_exec_count("wg pubkey") == 1,
+    "wg genkey and wg pubkey are run once");
+
+  fake_exec_reset();
+  expect(wg_generate_keys(wgs) != 0, "empty output is an error");
+  expect(wgs->priv_key_hash[0] == '\0' && wgs->pub_key_hash[0] == '\0', "failed keys are cleared");
+
+  fake_exec_reset();
+  fake_exec_fail(1);
+  fake_exec_output("key=\n");
+  expect(wg_generate_keys(wgs) != 0, "a failing wg is an error");
+  expect(exec_unit_start("wg-quick@wg9") != 0, "a failing unit start is reported");
+
+  fake_exec_reset();
+  exec_set_backend(NULL);
+  wg_settings_free_memory(wgs);
+
+  if (test_failed == 0) printf("exec backend: all checks passed\n");
+
+  return test_failed;
+}
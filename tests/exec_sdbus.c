@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "exec.h"
+#include "test.h"
+#include "fake_systemd.h"
+
+// ctest reports the test as skipped without a dbus-daemon.
+#define SKIPPED 77
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  int status = fake_systemd_start();
+  if (status == -1) {
+    printf("exec sdbus: no dbus-daemon, skipped\n");
+    return SKIPPED;
+  }
+  expect(status == 0, "the fake systemd is on the bus");
+
+  // wg-quick@wg9 without .service is rejected by systemd, the backend completes it.
+  expect(exec_unit_start("wg-quick@wg9") == 0, "wg-quick@wg9 is started over D-Bus");
+  expect(fake_systemd_count("EnableUnitFiles wg-quick@wg9.service") == 1, "the service is enabled");
+  expect(fake_systemd_count("StartUnit wg-quick@wg9.service") == 1, "the service is started");
+
+  expect(exec_unit_stop("wg-quick@wg9") == 0, "wg-quick@wg9 is stopped over D-Bus");
+  expect(fake_systemd_count("StopUnit wg-quick@wg9.service") == 1, "the service is stopped");
+  expect(fake_systemd_count("DisableUnitFiles wg-quick@wg9.service") == 1, "the service is disabled");
+
+  // Full names are passed on as they are, a failed job is an error.
+  expect(exec_unit_start("wg-quick@wg8.service") == 0, "a full unit name is started");
+  expect(fake_systemd_count("StartUnit wg-quick@wg8.service") == 1, "a full unit name is kept");
+  expect(exec_unit_start("fail@wg9") != 0, "a failed job is reported");
+
+  fake_systemd_stop();
+
+  if (test_failed == 0) printf("exec sdbus: all checks passed\n");
+
+  return test_failed;
+}
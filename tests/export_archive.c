@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "test.h"
+#include "export.h"
+#include "fake_exec.h"
+
+#define ARCHIVE TMP "export.tar"
+#define OLD "old archive\n"
+
+/**
+ * @return size of the archive or -1 if it doesn't exist.
+ */
+static long archive_size(void) {
+  struct stat st;
+
+  return stat(ARCHIVE, &st) == 0 ? (long)st.st_size : -1;
+}
+
+/**
+ * @return number of temporary archive files left in the folder.
+ */
+static int leftovers(void) {
+  DIR *dir = opendir(TMP);
+  if (dir == NULL) return -1;
+
+  int count = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL)
+    if (strncmp(entry->d_name, "export.tar.", 11) == 0) count++;
+
+  closedir(dir);
+
+  return count;
+}
+
+static void write_old_archive(void) {
+  FILE *fp = fopen(ARCHIVE, "w");
+  if (fp == NULL) exit(1);
+  fputs(OLD, fp);
+  fclose(fp);
+}
+
+/**
+ * @param char file name in the archive.
+ * @return 0 if the archive with one file was closed and 1 otherwise.
+ */
+static int export_one(const char *target, const char *name) {
+  export_archive archive;
+  if (export_open(&archive, target, 0) != 0) return 1;
+
+  export_add(&archive, name, "config\n", 7);
+
+  return export_close(&archive);
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  fake_exec_install();
+  write_old_archive();
+
+  // A run that fails before the first client must not cost the user the old archive.
+  export_archive archive;
+  expect(export_open(&archive, ARCHIVE, 0) == 0, "the archive is opened");
+  expect(archive_size() == (long)strlen(OLD), "opening leaves the old archive alone");
+  expect(export_close(&archive) == 0, "an empty archive is closed");
+  expect(archive_size() == (long)strlen(OLD), "an empty archive doesn't replace the old one");
+
+  // gzip is the fake pass-through filter, its failure at the end stands for any write error.
+  expect(export_open(&archive, ARCHIVE ".gz", 0) == 0, "the compressed archive is opened");
+  export_add(&archive, "a.conf", "config\n", 7);
+  fake_exec_fail(1);
+  expect(export_close(&archive) != 0, "a failed archive is reported");
+  expect(access(ARCHIVE ".gz", F_OK) != 0, "a failed archive is not published");
+  fake_exec_reset();
+
+  expect(export_one(ARCHIVE, "a.conf") == 0, "a complete archive is closed");
+  // Header, one block of data and the two end blocks.
+  expect(archive_size() == 4 * EXPORT_BLOCK, "the complete archive replaces the old one");
+
+  struct stat st;
+  expect(stat(ARCHIVE, &st) == 0 && (st.st_mode & 0777) == 0600, "the archive is only readable by us");
+  expect(leftovers() == 0, "no temporary file is left");
+
+  // Devices are written as they are.
+  expect(export_one("/dev/null", "a.conf") == 0, "an archive goes to a device");
+
+  unlink(ARCHIVE);
+
+  if (test_failed == 0) printf("export archive: all checks passed\n");
+
+  return test_failed;
+}
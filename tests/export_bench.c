@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "exec.h"
+#include "test.h"
+#include "export.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+#define CLIENTS 10000
+#define ARCHIVE TMP "bench.tar"
+
+/**
+ * @param struct timespec start of the interval.
+ * @return seconds elapsed since start.
+ */
+static double elapsed(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @param struct wireguard_settings to fill.
+ * @param int client number.
+ */
+static void client(wireguard_settings *wgs, int i) {
+  snprintf(wgs->name, 64, "bench-%d", i);
+  snprintf(wgs->priv_key_hash, 64, "private-%d=", i);
+  snprintf(wgs->pub_temp_hash, 64, "server=");
+  snprintf(wgs->subnetwork, 64, "10.0.9.%d/32, fd00:1:2:9::%x/128", 2 + i % 13, 2 + i);
+}
+
+/**
+ * One loose /tmp/<name>.conf per client, as --add writes without --export.
+ *
+ * @param struct wireguard_settings for the clients.
+ * @return seconds spent or -1 on error.
+ */
+static double loose_files(wireguard_settings *wgs) {
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < CLIENTS; i++) {
+    client(wgs, i);
+    if (wg_create_config_client(wgs, "192.0.2.1", "no") != 0) return -1;
+  }
+
+  double seconds = elapsed(&start);
+
+  char path[512];
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(path, 512, "%sbench-%d.conf", TMP, i);
+    unlink(path);
+  }
+
+  return seconds;
+}
+
+/**
+ * @param struct wireguard_settings for the clients.
+ * @param char archive name, .gz is compressed by the real gzip.
+ * @return seconds spent or -1 on error.
+ */
+static double exported(wireguard_settings *wgs, const char *target) {
+  export_archive archive;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (export_open(&archive, target, 0) != 0) return -1;
+
+  int status = 0;
+  for (int i = 0; i < CLIENTS && status == 0; i++) {
+    client(wgs, i);
+    status = export_client(&archive, wgs, "192.0.2.1", "no");
+  }
+  if (export_close(&archive) != 0) status = 1;
+
+  double seconds = elapsed(&start);
+
+  // Each config takes a header and at least one data block.
+  struct stat st;
+  expect(status == 0 && stat(target, &st) == 0 && st.st_size > 0, "the archive is written");
+  if (strstr(target, ".gz") == NULL)
+    expect(st.st_size >= (off_t)CLIENTS * 2 * EXPORT_BLOCK, "every client is in the archive");
+  unlink(target);
+
+  return status == 0 ? seconds : -1;
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) return 1;
+  wg_settings_init(wgs);
+
+  // One line per client would bury the table, it is printed on the real stdout at the end.
+  fflush(stdout);
+  int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  if (out == -1 || null == -1 || dup2(null, STDOUT_FILENO) == -1) return 1;
+  close(null);
+
+  // qrencode is faked for the loose files, only the writing of the configs is measured.
+  fake_exec_install();
+  double loose = loose_files(wgs);
+  double tar = exported(wgs, ARCHIVE);
+  exec_set_backend(NULL);
+  double gz = exported(wgs, ARCHIVE ".gz");
+
+  fflush(stdout);
+  dup2(out, STDOUT_FILENO);
+  close(out);
+  wg_settings_free_memory(wgs);
+
+  expect(loose >= 0 && tar >= 0 && gz >= 0, "every mode writes all configs");
+
+  printf("%d client configs\n", CLIENTS);
+  printf("loose files:           %8.3f s\n", loose);
+  printf("--export bench.tar:    %8.3f s\n", tar);
+  printf("--export bench.tar.gz: %8.3f s (gzip)\n", gz);
+
+  return test_failed;
+}
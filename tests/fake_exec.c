@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "exec.h"
+#include "fake_exec.h"
+
+char *fake_exec_log[FAKE_EXEC_LOG];
+size_t fake_exec_size = 0;
+
+static int failing = 0;
+static const char *printed = NULL;
+
+/**
+ * @param char first word of the command.
+ * @param char argv array terminated by NULL or NULL.
+ */
+static void record(const char *prefix, char *const argv[]) {
+  char line[1024];
+  size_t len = snprintf(line, 1024, "%s", prefix);
+
+  for (int i = 0; argv != NULL && argv[i] != NULL && len < 1024; i++)
+    len += snprintf(line + len, 1024 - len, "%s%s", len > 0 ? " " : "", argv[i]);
+
+  if (fake_exec_size < FAKE_EXEC_LOG) fake_exec_log[fake_exec_size++] = strdup(line);
+}
+
+static int fake_run(char *const argv[], int quiet) {
+  (void)quiet;
+  record("", argv);
+  return failing;
+}
+
+static int fake_capture(char *const argv[], const char *input, size_t input_size,
+                        char **output, size_t *output_size) {
+  record("", argv);
+
+  // Every stdin line is an entry of its own, tc -batch gets its commands that way.
+  for (size_t start = 0, end = 0; input != NULL && end < input_size; start = ++end) {
+    while (end < input_size && input[end] != '\n') end++;
+    char line[1024];
+    snprintf(line, 1024, "< %.*s", (int)(end - start), input + start);
+    if (fake_exec_size < FAKE_EXEC_LOG) fake_exec_log[fake_exec_size++] = strdup(line);
+  }
+
+  *output = strdup(printed != NULL ? printed : "");
+  *output_size = strlen(*output);
+  return failing;
+}
+
+static int fake_unit_start(const char *unit) {
+  char *argv[] = {(char*)unit, NULL};
+  record("unit start", argv);
+  return failing;
+}
+
+static int fake_unit_stop(const char *unit) {
+  char *argv[] = {(char*)unit, NULL};
+  record("unit stop", argv);
+  return failing;
+}
+
+static int fake_pipe_open(char *const argv[], int output_fd, int *input_fd, pid_t *pid) {
+  record("", argv);
+  *input_fd = dup(output_fd);
+  *pid = 0;
+  return *input_fd == -1 || failing;
+}
+
+static int fake_pipe_close(int input_fd, pid_t pid) {
+  (void)pid;
+  if (input_fd != -1) close(input_fd);
+  return failing;
+}
+
+static const exec_backend fake_backend = {
+  fake_run, fake_capture, fake_unit_start, fake_unit_stop, fake_pipe_open, fake_pipe_close,
+};
+
+void fake_exec_install(void) {
+  exec_set_backend(&fake_backend);
+}
+
+void fake_exec_reset(void) {
+  for (size_t i = 0; i < fake_exec_size; i++) free(fake_exec_log[i]);
+  fake_exec_size = 0;
+  failing = 0;
+  printed = NULL;
+}
+
+void fake_exec_fail(int fail) {
+  failing = fail;
+}
+
+void fake_exec_output(const char *output) {
+  printed = output;
+}
+
+int fake_exec_count(const char *command) {
+  int count = 0;
+
+  for (size_t i = 0; i < fake_exec_size; i++)
+    if (strcmp(fake_exec_log[i], command) == 0) count++;
+
+  return count;
+}
@@ -0,0 +1,42 @@
+#ifndef FAKE_EXEC_H
+#define FAKE_EXEC_H
+
+#include <stddef.h>
+
+#define FAKE_EXEC_LOG 1024
+
+/**
+ * Replaces every external program with a recorder: commands succeed
+ * without running and their argv is kept, joined by spaces, in fake_exec_log.
+ * Captured programs print nothing unless fake_exec_output() says otherwise,
+ * every line they get on stdin follows their command as "< <line>".
+ * Units are recorded as "unit start <name>" and "unit stop <name>", pipes
+ * pass the data through unchanged.
+ */
+void fake_exec_install(void);
+
+/**
+ * Forgets the recorded commands and goes back to silent successful programs.
+ */
+void fake_exec_reset(void);
+
+/**
+ * @param int 1 to make every following command fail.
+ */
+void fake_exec_fail(int fail);
+
+/**
+ * @param char what every following captured program prints, NULL for nothing.
+ */
+void fake_exec_output(const char *output);
+
+/**
+ * @param char command to look for.
+ * @return number of times it was recorded.
+ */
+int fake_exec_count(const char *command);
+
+extern char *fake_exec_log[FAKE_EXEC_LOG];
+extern size_t fake_exec_size;
+
+#endif
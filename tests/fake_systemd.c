@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <systemd/sd-bus.h>
+
+#include "fake_systemd.h"
+
+#define BUS TMP "fake-bus"
+
+static pid_t daemon_pid = -1;
+static pid_t manager_pid = -1;
+static unsigned int jobs = 0;
+
+/**
+ * @param char method that was called.
+ * @param char unit it was called for.
+ */
+static void log_call(const char *method, const char *unit) {
+  FILE *fp = fopen(FAKE_SYSTEMD_LOG, "a");
+  if (fp == NULL) return;
+
+  fprintf(fp, "%s %s\n", method, unit);
+  fclose(fp);
+}
+
+/**
+ * @param char unit name.
+ * @return 1 if systemd would take the name and 0 otherwise.
+ */
+static int valid_unit(const char *unit) {
+  size_t len = strlen(unit);
+
+  return len > 8 && strcmp(unit + len - 8, ".service") == 0;
+}
+
+/**
+ * @param struct sd_bus_message EnableUnitFiles or DisableUnitFiles call.
+ * @param char method name.
+ * @param struct sd_bus_error error of the reply.
+ * @return 1 if replied and a negative errno on error.
+ */
+static int unit_files(sd_bus_message *message, const char *method, sd_bus_error *error) {
+  char **units = NULL;
+  int r = sd_bus_message_read_strv(message, &units);
+  if (r < 0) return r;
+
+  for (int i = 0; units[i] != NULL; i++)
+    if (!valid_unit(units[i])) r = sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS,
+                                                     "Unit name %s is not valid.", units[i]);
+
+  for (int i = 0; units[i] != NULL; i++) {
+    if (r >= 0) log_call(method, units[i]);
+    free(units[i]);
+  }
+  free(units);
+
+  if (r < 0) return r;
+
+  if (strcmp(method, "EnableUnitFiles") == 0)
+    return sd_bus_reply_method_return(message, "ba(sss)", 0, 0);
+
+  return sd_bus_reply_method_return(message, "a(sss)", 0);
+}
+
+/**
+ * Replies with the job and sends its JobRemoved right away.
+ *
+ * @param struct sd_bus_message StartUnit or StopUnit call.
+ * @param char method name.
+ * @param struct sd_bus_error error of the reply.
+ * @return 1 if replied and a negative errno on error.
+ */
+static int unit_job(sd_bus_message *message, const char *method, sd_bus_error *error) {
+  const char *unit, *mode;
+  char path[64];
+
+  int r = sd_bus_message_read(message, "ss", &unit, &mode);
+  if (r < 0) return r;
+  if (!valid_unit(unit))
+    return sd_bus_error_setf(error, SD_BUS_ERROR_INVALID_ARGS, "Unit name %s is not valid.", unit);
+
+  log_call(method, unit);
+  snprintf(path, 64, "/org/freedesktop/systemd1/job/%u", ++jobs);
+
+  r = sd_bus_reply_method_return(message, "o", path);
+  if (r < 0) return r;
+
+  return sd_bus_emit_signal(sd_bus_message_get_bus(message), "/org/freedesktop/systemd1",
+    "org.freedesktop.systemd1.Manager", "JobRemoved", "uoss", jobs, path, unit,
+    strncmp(unit, "fail@", 5) == 0 ? "failed" : "done");
+}
+
+static int manager_call(sd_bus_message *message, void *userdata, sd_bus_error *error) {
+  const char *method = sd_bus_message_get_member(message);
+
+  (void)userdata;
+  if (method == NULL) return 0;
+
+  if (strcmp(method, "EnableUnitFiles") == 0 || strcmp(method, "DisableUnitFiles") == 0)
+    return unit_files(message, method, error);
+  if (strcmp(method, "StartUnit") == 0 || strcmp(method, "StopUnit") == 0)
+    return unit_job(message, method, error);
+  if (strcmp(method, "Subscribe") == 0 || strcmp(method, "Reload") == 0)
+    return sd_bus_reply_method_return(message, "");
+
+  return 0;
+}
+
+/**
+ * Serves the Manager object until it is killed.
+ *
+ * @param int pipe that gets one byte once the name is owned.
+ */
+static void manager(int ready) {
+  sd_bus *bus = NULL;
+  sd_bus_slot *slot = NULL;
+
+  if (sd_bus_open_system(&bus) < 0 ||
+      sd_bus_add_object(bus, &slot, "/org/freedesktop/systemd1", manager_call, NULL) < 0 ||
+      sd_bus_request_name(bus, "org.freedesktop.systemd1", 0) < 0 ||
+      write(ready, "", 1) != 1) _exit(1);
+  close(ready);
+
+  for (;;) {
+    int r = sd_bus_process(bus, NULL);
+    if (r < 0) _exit(1);
+    if (r == 0) sd_bus_wait(bus, UINT64_MAX);
+  }
+}
+
+/**
+ * @return 0 if the daemon listens, -1 if there is no dbus-daemon and 1 on error.
+ */
+static int start_daemon(void) {
+  int fds[2];
+  char address[512], print[32];
+
+  if (pipe(fds) == -1) return 1;
+  snprintf(print, 32, "--print-address=%d", fds[1]);
+
+  if ((daemon_pid = fork()) == -1) return 1;
+  if (daemon_pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) dup2(null, STDERR_FILENO);
+    close(fds[0]);
+    execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork",
+           "--address=unix:path=" BUS, print, (char*)NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  ssize_t len = 0, r;
+  while (len < 511 && (r = read(fds[0], address + len, 511 - len)) > 0) {
+    len += r;
+    if (memchr(address, '\n', len) != NULL) break;
+  }
+  close(fds[0]);
+
+  if (len <= 0) {
+    waitpid(daemon_pid, NULL, 0);
+    daemon_pid = -1;
+    return -1;
+  }
+
+  address[len] = '\0';
+  address[strcspn(address, "\n")] = '\0';
+
+  return setenv("DBUS_SYSTEM_BUS_ADDRESS", address, 1) == 0 ? 0 : 1;
+}
+
+int fake_systemd_start(void) {
+  int fds[2];
+  char byte;
+
+  unlink(BUS);
+  unlink(FAKE_SYSTEMD_LOG);
+
+  int status = start_daemon();
+  if (status != 0) return status;
+
+  if (pipe(fds) == -1) return 1;
+  if ((manager_pid = fork()) == -1) return 1;
+  if (manager_pid == 0) {
+    close(fds[0]);
+    manager(fds[1]);
+  }
+
+  close(fds[1]);
+  status = read(fds[0], &byte, 1) == 1 ? 0 : 1;
+  close(fds[0]);
+
+  if (status != 0) fprintf(stderr, "the fake systemd didn't get its name\n");
+
+  return status;
+}
+
+void fake_systemd_stop(void) {
+  pid_t *pids[] = {&manager_pid, &daemon_pid};
+
+  for (int i = 0; i < 2; i++) {
+    if (*pids[i] == -1) continue;
+    kill(*pids[i], SIGTERM);
+    waitpid(*pids[i], NULL, 0);
+    *pids[i] = -1;
+  }
+
+  unlink(BUS);
+}
+
+int fake_systemd_count(const char *call) {
+  FILE *fp = fopen(FAKE_SYSTEMD_LOG, "r");
+  if (fp == NULL) return 0;
+
+  int count = 0;
+  char buffer[512];
+  while (fgets(buffer, 512, fp) != NULL) {
+    buffer[strcspn(buffer, "\n")] = '\0';
+    count += strcmp(buffer, call) == 0;
+  }
+
+  fclose(fp);
+
+  return count;
+}
@@ -0,0 +1,28 @@
+#ifndef FAKE_SYSTEMD_H
+#define FAKE_SYSTEMD_H
+
+#define FAKE_SYSTEMD_LOG TMP "fake-systemd.log"
+
+/**
+ * Starts a private dbus-daemon and a fake org.freedesktop.systemd1 on it,
+ * DBUS_SYSTEM_BUS_ADDRESS points the D-Bus backend there. Like systemd it
+ * rejects unit names without their type, accepted calls are logged as
+ * "<method> <unit>" to FAKE_SYSTEMD_LOG. Jobs of units named fail@... finish
+ * with "failed", all others with "done".
+ *
+ * @return 0 if successful, -1 without dbus-daemon and 1 on error.
+ */
+int fake_systemd_start(void);
+
+/**
+ * Stops the fake systemd and its dbus-daemon.
+ */
+void fake_systemd_stop(void);
+
+/**
+ * @param char "<method> <unit>" line to look for.
+ * @return number of times it was logged.
+ */
+int fake_systemd_count(const char *call);
+
+#endif
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "journal.h"
+#include "export.h"
+#include "test.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+// Built with IPV6ENABLE, a dual-stack server holds far more clients than the largest group.
+#define SERVER "wg9"
+#define CLIENTS 512
+
+static const int sizes[] = {1, 8, 32, 128};
+
+/**
+ * @return 0 if successful and 1 on error.
+ */
+static int setup(void) {
+  if (test_folders() != 0) return 1;
+  unlink(TMP_JOURNAL_PATH JOURNAL_FILE);
+
+  FILE *fp = fopen(TMP_WG_PATH SERVER ".conf", "w");
+  if (fp == NULL) {
+    perror("server config creation error");
+    return 1;
+  }
+  fputs("[Interface]\nAddress = 10.0.9.1/28, fd00:1:2:9::1/64\nListenPort = 1346\n"
+        "PrivateKey = server=\n", fp);
+  fclose(fp);
+
+  return 0;
+}
+
+/**
+ * Adds CLIENTS clients to an empty server, the configs go to an archive
+ * in /dev/null so that only the journal and the server config are measured.
+ *
+ * @param int operations per journal sync.
+ * @return seconds spent or -1 on error.
+ */
+static double provision(int group) {
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) return -1;
+  wg_settings_init(wgs);
+
+  export_archive archive;
+  journal jn;
+  struct timespec start, end;
+
+  if (setup() != 0 || export_open(&archive, "/dev/null", 0) != 0) {
+    wg_settings_free_memory(wgs);
+    return -1;
+  }
+  if (journal_open(&jn) != 0) {
+    export_close(&archive);
+    wg_settings_free_memory(wgs);
+    return -1;
+  }
+  jn.archive = &archive;
+  jn.group_size = group;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  int status = 0;
+  for (int i = 0; i < CLIENTS && status == 0; i++) {
+    snprintf(wgs->name, 64, "bench-%d", i);
+    snprintf(wgs->priv_key_hash, 64, "private-%d=", i);
+    snprintf(wgs->pub_key_hash, 64, "public-%d=", i);
+    snprintf(wgs->pub_temp_hash, 64, "server=");
+    status = journal_add_client(&jn, wgs, SERVER, "192.0.2.1", "no", NULL, NULL);
+  }
+  // Also closes the archive.
+  if (journal_close(&jn) != 0) status = 1;
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  wg_settings_free_memory(wgs);
+
+  if (status != 0) return -1;
+
+  return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(void) {
+  double seconds[sizeof(sizes) / sizeof(sizes[0])];
+
+  fake_exec_install();
+
+  // The journal and the configs print a line per client, the table comes last.
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    seconds[i] = provision(sizes[i]);
+    if (seconds[i] < 0) {
+      fprintf(stderr, "group %d: provisioning failed\n", sizes[i]);
+      unlink(TMP_WG_PATH SERVER ".conf");
+      return 1;
+    }
+  }
+
+  unlink(TMP_WG_PATH SERVER ".conf");
+  fake_exec_reset();
+
+  printf("%d clients per run\n", CLIENTS);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    printf("group %3d: %8.3f s, %8.0f clients/s\n", sizes[i], seconds[i], CLIENTS / seconds[i]);
+
+  return 0;
+}
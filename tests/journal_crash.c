@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "journal.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+// A server number the developer machine is unlikely to use for its own configs.
+#define SERVER "wg9"
+#define CLIENTS 5
+#define ARCHIVE TMP_JOURNAL_PATH "crash.tar"
+
+static const char *steps[] = {"sync", "apply", "mark"};
+
+/**
+ * @param char file path.
+ * @param char text to count.
+ * @return number of lines equal to the text or -1 if the file can't be read.
+ */
+static int count_lines(const char *path, const char *text) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return -1;
+
+  int count = 0;
+  char buffer[512];
+
+  while (fgets(buffer, 512, file) != NULL) {
+    buffer[strcspn(buffer, "\n")] = '\0';
+    if (strcmp(buffer, text) == 0) count++;
+  }
+
+  fclose(file);
+
+  return count;
+}
+
+/**
+ * An empty server with nothing but the interface, a fresh journal and no client configs.
+ *
+ * @return 0 if successful and 1 on error.
+ */
+static int setup(void) {
+  if (test_folders() != 0) return 1;
+  unlink(TMP_JOURNAL_PATH JOURNAL_FILE);
+
+  FILE *fp = fopen(TMP_WG_PATH SERVER ".conf", "w");
+  if (fp == NULL) {
+    perror("server config creation error");
+    return 1;
+  }
+  fputs("[Interface]\nAddress = 10.0.9.1/28\nListenPort = 1346\nPrivateKey = server=\n", fp);
+  fclose(fp);
+
+  for (int i = 0; i < CLIENTS; i++) {
+    char path[256];
+    snprintf(path, 256, "%scrash-%d.conf", TMP, i);
+    unlink(path);
+  }
+
+  return 0;
+}
+
+/**
+ * Queues the clients and dies at the kill point of the step.
+ *
+ * @param char step from steps.
+ * @param int 1 to send the client configs to an archive that the crash loses.
+ */
+static void provision(const char *step, int exported) {
+  setenv("WW_CRASH", step, 1);
+  fake_exec_install();
+
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) _exit(2);
+  wg_settings_init(wgs);
+
+  journal jn;
+  export_archive archive;
+  if (journal_open(&jn) != 0) _exit(2);
+  if (exported) {
+    if (export_open(&archive, ARCHIVE, 0) != 0) _exit(2);
+    jn.archive = &archive;
+  }
+
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(wgs->name, 64, "crash-%d", i);
+    snprintf(wgs->priv_key_hash, 64, "private-%d=", i);
+    snprintf(wgs->pub_key_hash, 64, "public-%d=", i);
+    snprintf(wgs->pub_temp_hash, 64, "server=");
+    if (journal_add_client(&jn, wgs, SERVER, "192.0.2.1", "no", NULL, NULL) != 0) _exit(2);
+  }
+
+  journal_close(&jn);
+
+  // Reaching this point means the kill point was never hit.
+  _exit(0);
+}
+
+/**
+ * @param char step from steps.
+ * @return 0 if every client is in the server config once and has its config.
+ */
+static int check(const char *step) {
+  int failed = 0;
+
+  for (int i = 0; i < CLIENTS; i++) {
+    char line[64], path[256];
+    snprintf(line, 64, "PublicKey = public-%d=", i);
+    snprintf(path, 256, "%scrash-%d.conf", TMP, i);
+
+    int peers = count_lines(TMP_WG_PATH SERVER ".conf", line);
+    if (peers != 1) {
+      fprintf(stderr, "crash at %s: client %d is %d times in the server config\n", step, i, peers);
+      failed = 1;
+    }
+    if (access(path, F_OK) != 0) {
+      fprintf(stderr, "crash at %s: client %d has no config\n", step, i);
+      failed = 1;
+    }
+  }
+
+  struct stat st;
+  if (stat(TMP_JOURNAL_PATH JOURNAL_FILE, &st) != 0 || st.st_size != 0) {
+    fprintf(stderr, "crash at %s: the journal was not emptied\n", step);
+    failed = 1;
+  }
+
+  return failed;
+}
+
+int main(void) {
+  int failed = 0;
+
+  fake_exec_install();
+
+  // The second round exports: configs in an archive that never got closed are replayed to /tmp.
+  for (size_t round = 0; round < 2 * sizeof(steps) / sizeof(steps[0]); round++) {
+    size_t i = round % (sizeof(steps) / sizeof(steps[0]));
+    int exported = round >= sizeof(steps) / sizeof(steps[0]);
+    if (setup() != 0) return 1;
+
+    // Flushed before the fork, otherwise the child prints the buffer once more.
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("fork error");
+      return 1;
+    }
+    if (pid == 0) provision(steps[i], exported);
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+      fprintf(stderr, "crash at %s: the kill point was not reached\n", steps[i]);
+      failed = 1;
+      continue;
+    }
+
+    if (journal_recover() != 0) {
+      fprintf(stderr, "crash at %s: recovery failed\n", steps[i]);
+      failed = 1;
+      continue;
+    }
+
+    if (check(steps[i]) != 0) failed = 1;
+    else printf("crash at %s%s: recovered\n", steps[i], exported ? " with an archive" : "");
+  }
+
+  unlink(ARCHIVE);
+  unlink(TMP_WG_PATH SERVER ".conf");
+  fake_exec_reset();
+
+  return failed;
+}
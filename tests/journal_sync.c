@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "journal.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+#define SERVER "wg9"
+#define CLIENTS 8
+#define GROUP 4
+#define MAX_SYNCS 64
+#define ARCHIVE TMP "sync.tar"
+
+// Every sync in the order it happened, with the done markers on disk at that moment.
+static struct {
+  char path[512];
+  int markers;
+} syncs[MAX_SYNCS];
+static int syncs_count = 0;
+static char failing[512] = "";
+// Syncs of the failing path that still succeed.
+static int failing_after = 0;
+
+/**
+ * @param char type of the lines to count, "D" or "I".
+ * @return number of those lines in the journal.
+ */
+static int journal_lines(const char *type) {
+  FILE *file = fopen(TMP_JOURNAL_PATH JOURNAL_FILE, "r");
+  if (file == NULL) return 0;
+
+  int count = 0;
+  char buffer[512];
+  size_t len = strlen(type);
+
+  while (fgets(buffer, 512, file) != NULL)
+    if (strncmp(buffer, type, len) == 0 && buffer[len] == '\t') count++;
+
+  fclose(file);
+
+  return count;
+}
+
+/**
+ * @param char path to look for.
+ * @return how often the path was synced.
+ */
+static int synced(const char *path) {
+  int count = 0;
+
+  for (int i = 0; i < syncs_count; i++) count += strcmp(syncs[i].path, path) == 0;
+
+  return count;
+}
+
+static int fake_sync(int fd, const char *path) {
+  (void)fd;
+  int earlier = synced(path);
+  if (syncs_count < MAX_SYNCS) {
+    snprintf(syncs[syncs_count].path, 512, "%s", path);
+    syncs[syncs_count++].markers = journal_lines("D");
+  }
+
+  if (strcmp(path, failing) != 0 || earlier < failing_after) return 0;
+  errno = EIO;
+  return -1;
+}
+
+/**
+ * Adds CLIENTS clients in groups of GROUP to an empty server.
+ *
+ * @param int 1 to send the client configs to an archive.
+ * @return 0 if every group and the close succeeded and 1 otherwise.
+ */
+static int provision(int exported) {
+  unlink(TMP_JOURNAL_PATH JOURNAL_FILE);
+  FILE *fp = fopen(TMP_WG_PATH SERVER ".conf", "w");
+  if (fp == NULL) exit(1);
+  fputs("[Interface]\nAddress = 10.0.9.1/28\nListenPort = 1346\nPrivateKey = server=\n", fp);
+  fclose(fp);
+
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) exit(1);
+  wg_settings_init(wgs);
+
+  journal jn;
+  if (journal_open(&jn) != 0) exit(1);
+  jn.group_size = GROUP;
+
+  export_archive archive;
+  if (exported) {
+    if (export_open(&archive, ARCHIVE, 0) != 0) exit(1);
+    jn.archive = &archive;
+  }
+
+  int status = 0;
+  syncs_count = 0;
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(wgs->name, 64, "sync-%d", i);
+    snprintf(wgs->priv_key_hash, 64, "private-%d=", i);
+    snprintf(wgs->pub_key_hash, 64, "public-%d=", i);
+    snprintf(wgs->pub_temp_hash, 64, "server=");
+    // The client that completes a group gets the result of its commit.
+    if (journal_add_client(&jn, wgs, SERVER, "192.0.2.1", "no", NULL, NULL) != 0) status = 1;
+  }
+
+  wg_settings_free_memory(wgs);
+
+  if (journal_close(&jn) != 0) status = 1;
+
+  return status;
+}
+
+static void remove_client_configs(void) {
+  char path[512];
+
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(path, 512, "%ssync-%d.conf", TMP, i);
+    unlink(path);
+  }
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  fake_exec_install();
+  journal_set_sync(fake_sync);
+
+  expect(provision(0) == 0, "the clients are added");
+  expect(synced(TMP_WG_PATH SERVER ".conf") == CLIENTS / GROUP, "the server config is synced once per group");
+
+  char path[512];
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(path, 512, "%ssync-%d.conf", TMP, i);
+    expect(synced(path) == 1, "every client config is synced");
+  }
+
+  // Each group syncs the server config and its own client configs before any of its markers.
+  expect(syncs_count == 2 * (1 + GROUP), "nothing else is synced");
+  for (int i = 0; i < syncs_count; i++) {
+    int group = i >= syncs_count / 2;
+    expect(syncs[i].markers == group * GROUP, "configs are synced before the markers of their group");
+  }
+
+  // A config that can't be synced is not marked done and stays for the next run.
+  snprintf(failing, 512, "%ssync-5.conf", TMP);
+  expect(provision(0) != 0, "a failed sync is reported");
+  expect(journal_lines("D") == CLIENTS - 1, "only the synced clients are marked done");
+  expect(journal_lines("I") == CLIENTS, "the journal keeps the unsynced client");
+
+  failing[0] = '\0';
+  expect(journal_recover() == 0, "the unsynced client is replayed");
+  expect(journal_lines("I") == 0, "the journal is emptied after the replay");
+
+  // With an archive the failed second group is all that the next run replays to /tmp.
+  remove_client_configs();
+  snprintf(failing, 512, "%s", TMP_WG_PATH SERVER ".conf");
+  failing_after = 1;
+  expect(provision(1) != 0, "a failed group is reported");
+  failing[0] = '\0';
+  expect(journal_lines("D") == GROUP, "the archived clients are marked done");
+  expect(journal_recover() == 0, "the failed group is replayed");
+  for (int i = 0; i < CLIENTS; i++) {
+    snprintf(path, 512, "%ssync-%d.conf", TMP, i);
+    expect((access(path, F_OK) == 0) == (i >= GROUP), "only the failed group gets loose configs");
+  }
+
+  journal_set_sync(NULL);
+  unlink(TMP_WG_PATH SERVER ".conf");
+  unlink(ARCHIVE);
+  remove_client_configs();
+  fake_exec_reset();
+
+  if (test_failed == 0) printf("journal sync: all checks passed\n");
+
+  return test_failed;
+}
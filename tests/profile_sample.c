@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "mask.h"
+#include "test.h"
+#include "profile.h"
+#include "fake_exec.h"
+
+#define INTERFACE "server=\tserver-public=\t1337\toff\n"
+
+/**
+ * @param struct profile_measurement to add the sample to.
+ * @param char wg show dump, copied because it is cut into lines.
+ * @return result of profile_sample().
+ */
+static int sample(profile_measurement *m, const char *dump) {
+  char *copy = strdup(dump);
+  if (copy == NULL) exit(1);
+
+  int status = profile_sample(m, copy);
+  free(copy);
+
+  return status;
+}
+
+/**
+ * @param struct profile_measurement with the peers.
+ * @param char public key.
+ * @return the peer or NULL.
+ */
+static const profile_peer *find(const profile_measurement *m, const char *pub_key) {
+  for (size_t i = 0; i < m->count; i++)
+    if (strcmp(m->peers[i].pub_key, pub_key) == 0) return &m->peers[i];
+
+  return NULL;
+}
+
+int main(void) {
+  profile_measurement m = {NULL, 0, 0, 0};
+
+  // Peers in the order of the config, one never connected and one broken line.
+  expect(sample(&m, INTERFACE
+    "c=\t(none)\t198.51.100.7:40000\t10.0.9.4/32,fd00::4/128\t1000\t0\t0\t20\n"
+    "a=\t(none)\t192.0.2.1:51820\t10.0.9.2/32\t1000\t0\t0\t20\n"
+    "b=\t(none)\t[2001:db8::1]:51820\t10.0.9.3/32\t1000\t0\t0\t20\n"
+    "e=\t(none)\t(none)\t10.0.9.6/32\t0\t0\t0\toff\n"
+    "broken line\n") == 0, "the first sample is read");
+  expect(m.count == 4 && m.samples == 1, "every peer line is a peer, the interface and broken lines aren't");
+
+  const profile_peer *c = find(&m, "c=");
+  expect(c != NULL && strcmp(c->allowed, "10.0.9.4/32") == 0, "the first allowed IP names the peer");
+
+  // b keeps its address with a new port, c moves to another address, d appears.
+  expect(sample(&m, INTERFACE
+    "a=\t(none)\t192.0.2.1:51820\t10.0.9.2/32\t1120\t0\t0\t20\n"
+    "b=\t(none)\t[2001:db8::1]:40001\t10.0.9.3/32\t1000\t0\t0\t20\n"
+    "c=\t(none)\t203.0.113.9:40000\t10.0.9.4/32\t1130\t0\t0\t20\n"
+    "d=\t(none)\t192.0.2.50:51820\t10.0.9.5/32\t1100\t0\t0\t20\n"
+    "e=\t(none)\t(none)\t10.0.9.6/32\t0\t0\t0\toff\n") == 0, "the second sample is read");
+  expect(m.count == 5 && m.samples == 2, "a new peer is added once");
+
+  int sorted = 1;
+  for (size_t i = 1; i < m.count; i++) sorted &= strcmp(m.peers[i - 1].pub_key, m.peers[i].pub_key) < 0;
+  expect(sorted, "the peers are sorted after every sample");
+
+  const profile_peer *a = find(&m, "a="), *b = find(&m, "b="), *d = find(&m, "d="), *e = find(&m, "e=");
+  c = find(&m, "c=");
+  expect(a->roams == 0 && a->rebinds == 0 && a->handshakes == 1, "a stable peer renews its session");
+  expect(b->rebinds == 1 && b->roams == 0 && b->handshakes == 0, "a new port of the same address is a rebind");
+  expect(c->roams == 1 && c->rebinds == 0, "a new address is a roam");
+  expect(strcmp(c->endpoint, "203.0.113.9:40000") == 0, "the latest endpoint is kept");
+  expect(d->handshakes == 0 && d->handshake == 1100, "a new peer starts without changes");
+
+  // A rebind at the default means the NAT forgot the peer within KEEPALIVE seconds.
+  const client_profile *profile = profile_recommend(b, 60);
+  expect(profile != NULL && strcmp(profile->name, "mobile") == 0, "a rebinding peer gets mobile");
+  expect(profile != NULL && profile->keepalive > 0 && profile->keepalive < KEEPALIVE,
+    "mobile is shorter than the default that failed");
+  profile = profile_recommend(c, 60);
+  expect(profile != NULL && strcmp(profile->name, "mobile") == 0, "a roaming peer gets mobile");
+  profile = profile_recommend(a, 60);
+  expect(profile != NULL && strcmp(profile->name, "desktop") == 0 && profile->keepalive > KEEPALIVE,
+    "a stable peer gets a longer interval");
+  expect(profile_recommend(e, 60) == NULL, "a peer that never connected gets nothing");
+
+  // Without a renewal in PROFILE_IDLE_S the peer sent nothing, its mapping wasn't tested.
+  expect(profile_recommend(d, PROFILE_IDLE_S - 1) != NULL, "a short measurement can't tell idle peers");
+  expect(profile_recommend(d, PROFILE_IDLE_S) == NULL, "an idle peer gets nothing");
+  expect(profile_recommend(a, PROFILE_IDLE_S) != NULL, "a peer with a handshake isn't idle");
+
+  profile_free(&m);
+  expect(m.peers == NULL && m.count == 0, "the measurement is freed");
+
+  // A measurement of 0 seconds is one sample of wg show dump.
+  fake_exec_install();
+  fake_exec_output(INTERFACE "a=\t(none)\t192.0.2.1:51820\t10.0.9.2/32\t1000\t0\t0\t20\n");
+  expect(profile_measure("wg9", 0) == 0, "a server is measured");
+  expect(fake_exec_count("wg show wg9 dump") == 1, "wg show dump is read once");
+  fake_exec_reset();
+  fake_exec_fail(1);
+  expect(profile_measure("wg9", 0) != 0, "a failing wg is an error");
+  fake_exec_reset();
+
+  if (test_failed == 0) printf("profile sample: all checks passed\n");
+
+  return test_failed;
+}
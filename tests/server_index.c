@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "wireguard.h"
+#include "server_index.h"
+
+#define SERVER "wg9"
+
+/**
+ * @param char text appended to the server config.
+ */
+static void append_config(const char *text) {
+  FILE *fp = fopen(TMP_WG_PATH SERVER ".conf", "a");
+  if (fp == NULL) {
+    perror("server config writing error");
+    exit(1);
+  }
+  fputs(text, fp);
+  fclose(fp);
+}
+
+/**
+ * @return peers of the test server in the index or -1 if it is not there.
+ */
+static int indexed_peers(void) {
+  server_index idx;
+  int peers = -1;
+
+  if (server_index_get(&idx) != 0) return -1;
+  for (size_t i = 0; i < idx.count; i++)
+    if (strcmp(idx.entries[i].name, SERVER) == 0) peers = idx.entries[i].peers;
+  server_index_free(&idx);
+
+  return peers;
+}
+
+/**
+ * Changes the peers of the test server in the saved index without touching the config.
+ *
+ * @param int peers to write.
+ */
+static void forge_index(int peers) {
+  server_index idx;
+  if (server_index_get(&idx) != 0) return;
+  for (size_t i = 0; i < idx.count; i++)
+    if (strcmp(idx.entries[i].name, SERVER) == 0) idx.entries[i].peers = peers;
+  server_index_write(&idx);
+  server_index_free(&idx);
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+  unlink(TMP_WG_PATH SERVER ".conf");
+  append_config("[Interface]\nAddress = 10.0.9.1/28\nListenPort = 1346\nPrivateKey = server=\n"
+                "\n[Peer]\nPublicKey = a=\nAllowedIPs = 10.0.9.2/32\n"
+                "\n[Peer]\nPublicKey = b=\nAllowedIPs = 10.0.9.3/32\n");
+
+  expect(indexed_peers() == 2, "a new config is scanned");
+
+  // An unchanged folder is answered from the index alone.
+  forge_index(7);
+  expect(indexed_peers() == 7, "the saved index is used while nothing changed");
+
+  append_config("\n[Peer]\nPublicKey = c=\nAllowedIPs = 10.0.9.4/32\n");
+  expect(indexed_peers() == 3, "a changed config is scanned again");
+
+  server_index idx;
+  if (server_index_get(&idx) == 0) {
+    for (size_t i = 0; i < idx.count; i++)
+      if (strcmp(idx.entries[i].name, SERVER) == 0)
+        expect(idx.entries[i].capacity == CLIENTS_SERVER - 1, "an IPv4 server holds 13 clients");
+    server_index_free(&idx);
+  }
+
+  unlink(TMP_WG_PATH SERVER ".conf");
+  expect(indexed_peers() == -1, "a removed config leaves the index");
+
+  if (test_failed == 0) printf("server index: all checks passed\n");
+
+  return test_failed;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "tc.h"
+#include "test.h"
+#include "journal.h"
+#include "wireguard.h"
+#include "fake_exec.h"
+
+#define SERVER "wg9"
+#define TIERS TMP_TIERS_PATH SERVER ".tiers"
+
+/**
+ * @param char commands that tc_apply() has to run, in this order.
+ * @param size_t number of commands.
+ * @param char description of the check.
+ */
+static void expect_commands(const char *const commands[], size_t count, const char *what) {
+  int same = fake_exec_size == count;
+
+  for (size_t i = 0; same && i < count; i++) same = strcmp(fake_exec_log[i], commands[i]) == 0;
+
+  if (!same) {
+    for (size_t i = 0; i < fake_exec_size; i++) fprintf(stderr, "  ran: %s\n", fake_exec_log[i]);
+  }
+  expect(same, what);
+}
+
+/**
+ * Adds one client through the journal, as --add does.
+ *
+ * @param char client name and key.
+ * @param char tier or NULL.
+ */
+static void add_client(const char *name, const char *tier) {
+  wireguard_settings *wgs = malloc(sizeof(wireguard_settings));
+  if (wgs == NULL) exit(1);
+  wg_settings_init(wgs);
+
+  snprintf(wgs->name, 64, "%s", name);
+  snprintf(wgs->priv_key_hash, 64, "%s-private=", name);
+  snprintf(wgs->pub_key_hash, 64, "%s-public=", name);
+  snprintf(wgs->pub_temp_hash, 64, "server=");
+
+  journal jn;
+  if (journal_open(&jn) != 0) exit(1);
+  expect(journal_add_client(&jn, wgs, SERVER, "192.0.2.1", "no", tier, NULL) == 0, "client is queued");
+  journal_close(&jn);
+
+  wg_settings_free_memory(wgs);
+}
+
+/**
+ * @param char address to look for.
+ * @return number of entries for the address in the tiers file.
+ */
+static int count_tiers(const char *address) {
+  FILE *file = fopen(TIERS, "r");
+  if (file == NULL) return 0;
+
+  char buffer[256], current[64];
+  int found = 0;
+
+  while (fgets(buffer, 256, file) != NULL)
+    if (sscanf(buffer, "%63s", current) == 1 && strcmp(current, address) == 0) found++;
+
+  fclose(file);
+
+  return found;
+}
+
+/**
+ * @param char address to look for.
+ * @return 1 if the tiers file has an entry for the address and 0 if not.
+ */
+static int has_tier(const char *address) {
+  return count_tiers(address) > 0;
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+  unlink(TIERS);
+
+  fake_exec_install();
+
+  expect(tc_record_tier(SERVER, "10.0.9.2/32", "gold") == 0, "gold is recorded");
+  expect(tc_record_tier(SERVER, "10.0.9.3/32, fd00:1:2:9::3/128", "bronze") == 0, "bronze is recorded");
+
+  fake_exec_reset();
+  expect(tc_apply(SERVER) == 0, "tc_apply succeeds");
+  const char *const tree[] = {
+    "tc qdisc del dev wg9 root",
+    "tc -batch -",
+    "< qdisc add dev wg9 root handle 1: htb default 1",
+    "< class add dev wg9 parent 1: classid 1:1 htb rate 10gbit",
+    "< class add dev wg9 parent 1: classid 1:10 htb rate 200mbit ceil 200mbit",
+    "< qdisc add dev wg9 parent 1:10 fq_codel",
+    "< filter add dev wg9 parent 1: protocol ip prio 1 u32 match ip dst 10.0.9.2/32 flowid 1:10",
+    "< class add dev wg9 parent 1: classid 1:11 htb rate 10mbit ceil 10mbit",
+    "< qdisc add dev wg9 parent 1:11 fq_codel",
+    "< filter add dev wg9 parent 1: protocol ip prio 1 u32 match ip dst 10.0.9.3/32 flowid 1:11",
+    "< filter add dev wg9 parent 1: protocol ipv6 prio 2 u32 match ip6 dst fd00:1:2:9::3/128 flowid 1:11",
+  };
+  expect_commands(tree, sizeof(tree) / sizeof(tree[0]), "one tc -batch with a class, qdisc and filter per peer");
+
+  // A new tier replaces the entry, a missing one removes it.
+  expect(tc_record_tier(SERVER, "10.0.9.3/32, fd00:1:2:9::3/128", "silver") == 0, "silver replaces bronze");
+  expect(tc_record_tier(SERVER, "10.0.9.2/32", NULL) == 0, "the gold entry is removed");
+
+  fake_exec_reset();
+  expect(tc_apply(SERVER) == 0, "tc_apply succeeds");
+  const char *const changed[] = {
+    "tc qdisc del dev wg9 root",
+    "tc -batch -",
+    "< qdisc add dev wg9 root handle 1: htb default 1",
+    "< class add dev wg9 parent 1: classid 1:1 htb rate 10gbit",
+    "< class add dev wg9 parent 1: classid 1:10 htb rate 50mbit ceil 50mbit",
+    "< qdisc add dev wg9 parent 1:10 fq_codel",
+    "< filter add dev wg9 parent 1: protocol ip prio 1 u32 match ip dst 10.0.9.3/32 flowid 1:10",
+    "< filter add dev wg9 parent 1: protocol ipv6 prio 2 u32 match ip6 dst fd00:1:2:9::3/128 flowid 1:10",
+  };
+  expect_commands(changed, sizeof(changed) / sizeof(changed[0]), "only the silver peer is shaped");
+
+  // A group is one rewrite: entries of other servers' peers stay, the group's replace theirs.
+  const tc_peer group[] = {
+    {"10.0.9.3/32, fd00:1:2:9::3/128", "-"},
+    {"10.0.9.4/32", "gold"},
+    {"10.0.9.5/32", "bronze"},
+    {"10.0.9.5/32", "silver"},
+  };
+  expect(tc_record_tiers(SERVER, group, sizeof(group) / sizeof(group[0])) == 0, "a group is recorded");
+  expect(!has_tier("10.0.9.3/32") && has_tier("10.0.9.4/32"), "the group replaces and adds entries");
+  expect(count_tiers("10.0.9.5/32") == 1, "a peer twice in the group has one entry");
+
+  // A removed peer frees its address, the next client gets it without the old tier.
+  unlink(TIERS);
+  unlink(TMP_JOURNAL_PATH JOURNAL_FILE);
+  FILE *fp = fopen(TMP_WG_PATH SERVER ".conf", "w");
+  if (fp == NULL) return 1;
+  fputs("[Interface]\nAddress = 10.0.9.1/28\nListenPort = 1346\nPrivateKey = server=\n", fp);
+  fclose(fp);
+
+  add_client("tier-old", "gold");
+  expect(has_tier("10.0.9.2/32"), "the first client is in the gold tier");
+
+  fp = fopen(TMP_WG_PATH SERVER ".conf", "w");
+  if (fp == NULL) return 1;
+  fputs("[Interface]\nAddress = 10.0.9.1/28\nListenPort = 1346\nPrivateKey = server=\n", fp);
+  fclose(fp);
+
+  add_client("tier-new", NULL);
+  expect(!has_tier("10.0.9.2/32"), "the reused address is no longer shaped");
+
+  unlink(TIERS);
+  unlink(TMP_WG_PATH SERVER ".conf");
+  unlink(TMP "tier-old.conf");
+  unlink(TMP "tier-new.conf");
+  fake_exec_reset();
+
+  if (test_failed == 0) printf("tc: all checks passed\n");
+
+  return test_failed;
+}
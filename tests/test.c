@@ -0,0 +1,31 @@
+#include <stdio.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "tc.h"
+#include "test.h"
+#include "journal.h"
+#include "wireguard.h"
+#include "server_index.h"
+
+int test_failed = 0;
+
+int test_folders(void) {
+  const char *folders[] = {TMP, TMP_WG_PATH, TMP_JOURNAL_PATH, TMP_SERVER_INDEX_PATH, TMP_TIERS_PATH};
+
+  for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); i++) {
+    if (mkdir(folders[i], 0700) != 0 && errno != EEXIST) {
+      perror("test folder creation error");
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+void expect(int condition, const char *what) {
+  if (!condition) {
+    fprintf(stderr, "failed: %s\n", what);
+    test_failed = 1;
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef TEST_H
+#define TEST_H
+
+/**
+ * Creates the TEMPDIR folders. The test build points them into its own
+ * folder, so no real config in /tmp is ever touched.
+ *
+ * @return 0 if successful and 1 on error.
+ */
+int test_folders(void);
+
+/**
+ * @param int condition that has to hold.
+ * @param char description of the check, printed if it fails.
+ */
+void expect(int condition, const char *what);
+
+// 1 once any expect() has failed, the exit status of the test.
+extern int test_failed;
+
+#endif
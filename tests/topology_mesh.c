@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "mask.h"
+#include "test.h"
+#include "topology.h"
+
+#define INVENTORY TMP "nodes.txt"
+#define OUTDIR TMP "mesh"
+
+/**
+ * @param char inventory lines.
+ * @param enum topology_kind mesh or hub-and-spoke.
+ * @param size_t pointer to which the number of nodes will be written.
+ * @return nodes of the inventory or NULL if it was rejected.
+ */
+static topology_node *inventory(const char *lines, topology_kind kind, size_t *count) {
+  FILE *fp = fopen(INVENTORY, "w");
+  if (fp == NULL) exit(1);
+  fputs(lines, fp);
+  fclose(fp);
+
+  // The keys only have to tell the peers apart, wg isn't needed for that.
+  topology_node *nodes = topology_read_inventory(INVENTORY, kind, count);
+  for (size_t i = 0; nodes != NULL && i < *count; i++) {
+    snprintf(nodes[i].priv_key_hash, 64, "private-%.32s=", nodes[i].name);
+    snprintf(nodes[i].pub_key_hash, 64, "public-%.32s=", nodes[i].name);
+  }
+
+  return nodes;
+}
+
+/**
+ * @param char node name.
+ * @param char line to look for.
+ * @return number of lines in the config of the node that start with it.
+ */
+static int config_lines(const char *name, const char *line) {
+  char path[512], buffer[512];
+  snprintf(path, 512, "%s/%s.conf", OUTDIR, name);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) return -1;
+
+  int count = 0;
+  while (fgets(buffer, 512, fp) != NULL) count += strncmp(buffer, line, strlen(line)) == 0;
+  fclose(fp);
+
+  return count;
+}
+
+/**
+ * @param char node name.
+ * @param char public key of the peer.
+ * @return 1 if the peer section of that key has PersistentKeepalive and 0 otherwise.
+ */
+static int keepalive_toward(const char *name, const char *pub_key) {
+  char path[512], buffer[512], key[128];
+  snprintf(path, 512, "%s/%s.conf", OUTDIR, name);
+  snprintf(key, 128, "PublicKey = %s\n", pub_key);
+
+  FILE *fp = fopen(path, "r");
+  if (fp == NULL) return 0;
+
+  int in_peer = 0, found = 0;
+  while (fgets(buffer, 512, fp) != NULL) {
+    if (strncmp(buffer, "PublicKey", 9) == 0) in_peer = strcmp(buffer, key) == 0;
+    if (in_peer && strncmp(buffer, "PersistentKeepalive", 19) == 0) found = 1;
+  }
+  fclose(fp);
+
+  return found;
+}
+
+static void remove_configs(const char *names[], int count) {
+  char path[512];
+
+  for (int i = 0; i < count; i++) {
+    snprintf(path, 512, "%s/%s.conf", OUTDIR, names[i]);
+    unlink(path);
+  }
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  size_t count;
+  const char *names[] = {"a", "b", "c", "d"};
+
+  // a and b are reachable, c and d sit behind NAT.
+  topology_node *nodes = inventory(
+    "# name address endpoint\n"
+    "a 10.9.0.1/24 192.0.2.1:51820\n"
+    "b 10.9.0.2/24 192.0.2.2:51821\n"
+    "c 10.9.0.3/24 -\n"
+    "\n"
+    "d 10.9.0.4/24 -\n", TOPOLOGY_MESH, &count);
+  expect(nodes != NULL && count == 4, "the inventory is read");
+  if (nodes == NULL) return test_failed;
+
+  expect(topology_create_configs(nodes, count, TOPOLOGY_MESH, OUTDIR) == 0, "the mesh is written");
+  for (int i = 0; i < 4; i++) {
+    expect(config_lines(names[i], "[Peer]") == 3, "every node has all others as peers");
+    expect(config_lines(names[i], "AllowedIPs = 10.9.0.") == 3, "every peer owns its /32");
+  }
+  expect(config_lines("a", "ListenPort = 51820") == 1 && config_lines("b", "ListenPort = 51821") == 1,
+    "reachable nodes listen on the port of their endpoint");
+  expect(config_lines("c", "ListenPort") == 0, "nodes behind NAT have no ListenPort");
+  expect(config_lines("c", "Endpoint") == 2, "only reachable peers have an endpoint");
+  expect(config_lines("a", "PersistentKeepalive") == 0, "reachable nodes send no keepalive");
+  expect(keepalive_toward("c", "public-a=") && keepalive_toward("c", "public-b="),
+    "a node behind NAT keeps its mappings toward reachable peers open");
+  expect(!keepalive_toward("c", "public-d=") && !keepalive_toward("d", "public-c="),
+    "no keepalive between two nodes without endpoints");
+  free(nodes);
+
+  // The hub owns the network for the spokes.
+  nodes = inventory("a 10.9.0.1/24 192.0.2.1:51820\nb 10.9.0.2/24 -\nc 10.9.0.3/24 192.0.2.3:51820\n",
+    TOPOLOGY_HUB, &count);
+  expect(nodes != NULL && topology_create_configs(nodes, count, TOPOLOGY_HUB, OUTDIR) == 0, "the hub is written");
+  expect(config_lines("a", "[Peer]") == 2 && config_lines("a", "PostUp") == 1, "the hub forwards between spokes");
+  expect(config_lines("b", "[Peer]") == 1 && config_lines("b", "AllowedIPs = 10.9.0.0/24") == 1,
+    "a spoke reaches the network through the hub");
+  expect(keepalive_toward("b", "public-a=") && config_lines("c", "PersistentKeepalive") == 0,
+    "only spokes behind NAT send keepalive");
+  free(nodes);
+
+  expect(inventory("a 10.9.0.1/24 192.0.2.1:51820\nb 10.9.0.1/24 -\n", TOPOLOGY_MESH, &count) == NULL,
+    "two nodes with one address are rejected");
+  expect(inventory("a 10.9.0.1/24 192.0.2.1:51820\nb 10.9.0.1/32 -\n", TOPOLOGY_MESH, &count) == NULL,
+    "the prefix doesn't make an address different");
+  expect(inventory("a 10.9.0.1/24 192.0.2.1:51820\na 10.9.0.2/24 -\n", TOPOLOGY_MESH, &count) == NULL,
+    "two nodes with one name are rejected");
+  expect(inventory("a 10.9.0.1/24 -\nb 10.9.0.2/24 192.0.2.2:51820\n", TOPOLOGY_HUB, &count) == NULL,
+    "a hub without endpoint is rejected");
+  expect(inventory("a 10.9.0.1/24 192.0.2.1\n", TOPOLOGY_MESH, &count) == NULL, "an endpoint needs a port");
+
+  remove_configs(names, 4);
+  rmdir(OUTDIR);
+  unlink(INVENTORY);
+
+  if (test_failed == 0) printf("topology mesh: all checks passed\n");
+
+  return test_failed;
+}
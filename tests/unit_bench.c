@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "exec.h"
+#include "test.h"
+#ifdef SDBUS
+  #include "fake_systemd.h"
+#endif
+
+#define ROUNDS 200
+#define BIN TMP "bin/"
+
+/**
+ * @param struct timespec start of the interval.
+ * @param int number of calls in the interval.
+ * @return microseconds per call since start.
+ */
+static double per_call(const struct timespec *start, int calls) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return ((now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) / 1e3) / calls;
+}
+
+#ifndef SDBUS
+/**
+ * Puts a systemctl that does nothing first in PATH, the real one would touch the host.
+ *
+ * @return 0 if successful and 1 on error.
+ */
+static int fake_systemctl(void) {
+  char path[1024];
+
+  if (mkdir(BIN, 0755) == -1 && access(BIN, F_OK) != 0) return 1;
+
+  FILE *fp = fopen(BIN "systemctl", "w");
+  if (fp == NULL) return 1;
+  fputs("#!/bin/sh\nexit 0\n", fp);
+  fclose(fp);
+  if (chmod(BIN "systemctl", 0755) == -1) return 1;
+
+  const char *old = getenv("PATH");
+  snprintf(path, 1024, "%s:%s", BIN, old != NULL ? old : "/usr/bin:/bin");
+
+  return setenv("PATH", path, 1) == 0 ? 0 : 1;
+}
+#endif
+
+/**
+ * @return microseconds per start and stop of a unit or -1 on error.
+ */
+static double units(void) {
+  struct timespec start;
+  int status = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < ROUNDS && status == 0; i++)
+    status = exec_unit_start("wg-quick@bench") || exec_unit_stop("wg-quick@bench");
+
+  return status == 0 ? per_call(&start, 2 * ROUNDS) : -1;
+}
+
+int main(void) {
+  if (test_folders() != 0) return 1;
+
+  char *argv[] = {"true", NULL};
+  struct timespec start;
+  int status = 0;
+
+  // The spawn backend against what the old code did, a shell for every command.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < ROUNDS; i++) status |= system("true");
+  double shell = per_call(&start, ROUNDS);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < ROUNDS; i++) status |= exec_run(argv, 0);
+  double spawn = per_call(&start, ROUNDS);
+
+  expect(status == 0, "true runs");
+
+#ifdef SDBUS
+  // Only the bus round trips are measured, the jobs of the fake systemd finish at once.
+  const char *backend = "D-Bus";
+  double unit = -1;
+  int started = fake_systemd_start();
+  if (started == 0) unit = units();
+  expect(started != 1, "the fake systemd is on the bus");
+  if (started == 0) expect(unit >= 0, "the units are started and stopped");
+  fake_systemd_stop();
+#else
+  const char *backend = "systemctl";
+  expect(fake_systemctl() == 0, "the fake systemctl is installed");
+  double unit = units();
+  expect(unit >= 0, "the units are started and stopped");
+#endif
+
+  printf("%d calls each\n", ROUNDS);
+  printf("system(\"true\"):        %8.1f us\n", shell);
+  printf("exec_run(true):        %8.1f us\n", spawn);
+  char label[64];
+  snprintf(label, 64, "unit start/stop (%s):", backend);
+  if (unit >= 0) printf("%-23s%8.1f us\n", label, unit);
+  else printf("%s skipped, no dbus-daemon\n", label);
+
+  return test_failed;
+}